@@ -0,0 +1,231 @@
+#version 450
+
+// GPU counterpart of the renderer's CPU culling.  One invocation per chunk
+// slot tests the chunk against the view radius, the frustum and last frame's
+// depth pyramid, then appends its record and one draw command per run of
+// visible face directions.
+
+layout (local_size_x = 64) in;
+
+// Matches struct renderer_slot.  A slot with no faces is unused.
+struct slot
+{
+	ivec4 origin;
+	ivec2 faces[6];
+};
+
+// Matches struct DrawElementsCommand.
+struct command
+{
+	uint count;
+	uint instance_count;
+	uint first_index;
+	int base_vertex;
+	uint base_instance;
+};
+
+// Matches struct renderer_chunk.
+struct chunk
+{
+	ivec4 origin;
+};
+
+layout (std430, binding = 1) writeonly buffer chunks
+{
+	chunk chunk_data[];
+};
+
+layout (std430, binding = 2) readonly buffer slots
+{
+	slot slot_data[];
+};
+
+layout (std430, binding = 3) writeonly buffer commands
+{
+	command command_data[];
+};
+
+// Cleared before each dispatch.  command_count is the draw count read by
+// glMultiDrawElementsIndirectCountARB().
+layout (std430, binding = 4) buffer counters
+{
+	uint command_count;
+	uint chunk_count;
+};
+
+// Furthest depth per texel, from depth_pyramid.comp.glsl.
+layout (binding = 0) uniform sampler2D depth_pyramid;
+
+layout (location = 0) uniform vec4 frustum_planes[6];
+layout (location = 6) uniform vec3 camera_position;
+
+// Chunks further than view_radius chunks from view_chunk on x or z are not
+// drawn, as on the CPU path.
+layout (location = 7) uniform ivec2 view_chunk;
+layout (location = 8) uniform int view_radius;
+
+layout (location = 9) uniform uint slot_count;
+
+// The view-projection matrix depth_pyramid was rendered with.
+layout (location = 10) uniform mat4 occlusion_matrix;
+layout (location = 14) uniform bool occlusion_enabled;
+
+const float chunk_length = 32.0;
+
+bool frustum_visible(vec3 center, vec3 extent)
+{
+	for (int i = 0; i < 6; i++)
+	{
+		vec4 plane = frustum_planes[i];
+
+		if (dot(plane.xyz, center) + plane.w + dot(abs(plane.xyz), extent) < 0.0)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// True when the box is behind the depth already drawn over its whole screen
+// rectangle.
+bool occluded(vec3 box_min, vec3 box_max)
+{
+	vec2 ndc_min = vec2(1.0);
+	vec2 ndc_max = vec2(-1.0);
+	float depth_min = 1.0;
+
+	for (int i = 0; i < 8; i++)
+	{
+		vec3 corner = mix(box_min, box_max, vec3(i & 1, (i >> 1) & 1, (i >> 2) & 1));
+		vec4 clip = occlusion_matrix * vec4(corner, 1.0);
+
+		// Crossing the near plane, so it covers the camera.
+		if (clip.w <= 0.0)
+		{
+			return false;
+		}
+
+		vec3 ndc = clip.xyz / clip.w;
+
+		ndc_min = min(ndc_min, ndc.xy);
+		ndc_max = max(ndc_max, ndc.xy);
+		depth_min = min(depth_min, ndc.z * 0.5 + 0.5);
+	}
+
+	ndc_min = clamp(ndc_min, -1.0, 1.0);
+	ndc_max = clamp(ndc_max, -1.0, 1.0);
+
+	// Pick the level at which the rectangle spans at most 2 texels per axis.
+	vec2 size = vec2(textureSize(depth_pyramid, 0));
+	vec2 texel_min = (ndc_min * 0.5 + 0.5) * size;
+	vec2 texel_max = (ndc_max * 0.5 + 0.5) * size;
+
+	vec2 extent = texel_max - texel_min;
+	int level = int(ceil(log2(max(max(extent.x, extent.y), 1.0))));
+	level = clamp(level, 0, textureQueryLevels(depth_pyramid) - 1);
+
+	ivec2 level_size = textureSize(depth_pyramid, level);
+	ivec2 a = clamp(ivec2(texel_min / exp2(float(level))), ivec2(0), level_size - 1);
+	ivec2 b = clamp(ivec2(texel_max / exp2(float(level))), ivec2(0), level_size - 1);
+
+	float depth_max = max(
+		max(texelFetch(depth_pyramid, a, level).r, texelFetch(depth_pyramid, ivec2(b.x, a.y), level).r),
+		max(texelFetch(depth_pyramid, ivec2(a.x, b.y), level).r, texelFetch(depth_pyramid, b, level).r));
+
+	return depth_min > depth_max;
+}
+
+void main()
+{
+	uint index = gl_GlobalInvocationID.x;
+
+	if (index >= slot_count)
+	{
+		return;
+	}
+
+	slot s = slot_data[index];
+
+	ivec2 distance = abs(s.origin.xz / int(chunk_length) - view_chunk);
+
+	if (distance.x > view_radius || distance.y > view_radius)
+	{
+		return;
+	}
+
+	vec3 box_min = vec3(s.origin.xyz);
+	vec3 box_max = box_min + chunk_length;
+
+	if (frustum_visible((box_min + box_max) * 0.5, vec3(chunk_length * 0.5)) == false)
+	{
+		return;
+	}
+
+	if (occlusion_enabled && occluded(box_min, box_max))
+	{
+		return;
+	}
+
+	// Backface culling at the chunk level, as in render_chunk_commands().
+	bool visible[6] = bool[6](
+		camera_position.y < box_max.y,
+		camera_position.y > box_min.y,
+		camera_position.z < box_max.z,
+		camera_position.z > box_min.z,
+		camera_position.x < box_max.x,
+		camera_position.x > box_min.x);
+
+	uint runs = 0u;
+	bool run = false;
+
+	for (int normal = 0; normal < 6; normal++)
+	{
+		bool drawn = visible[normal] && s.faces[normal].y > 0;
+
+		if (drawn && run == false)
+		{
+			runs++;
+		}
+
+		run = drawn;
+	}
+
+	if (runs == 0u)
+	{
+		return;
+	}
+
+	// At most 3 runs per chunk, so the command buffer, sized for 6 commands
+	// per chunk, cannot overflow.
+	uint chunk_index = atomicAdd(chunk_count, 1u);
+	uint command_index = atomicAdd(command_count, runs);
+
+	chunk_data[chunk_index].origin = ivec4(s.origin.xyz, 0);
+
+	// Faces are stored back to back in normal order, so a run of drawn
+	// directions is one contiguous range.
+	uint count = 0u;
+	int base_vertex = 0;
+
+	for (int normal = 0; normal <= 6; normal++)
+	{
+		bool drawn = normal < 6 && visible[normal] && s.faces[normal].y > 0;
+
+		if (drawn)
+		{
+			if (count == 0u)
+			{
+				base_vertex = s.faces[normal].x;
+			}
+
+			count += uint(s.faces[normal].y / 4 * 6);
+		}
+		else if (count > 0u)
+		{
+			command_data[command_index++] = command(count, 1u, 0u, base_vertex, chunk_index);
+
+			count = 0u;
+		}
+	}
+}
@@ -0,0 +1,59 @@
+#version 450
+
+// Builds one level of the depth pyramid the cull shader tests against.  Each
+// texel holds the furthest depth of the texels below it, so a box nearer than
+// a texel is in front of everything that texel covers.
+
+layout (local_size_x = 8, local_size_y = 8) in;
+
+// The depth buffer for the first level, otherwise the pyramid itself.
+layout (binding = 0) uniform sampler2D source;
+
+layout (r32f, binding = 0) writeonly uniform image2D destination;
+
+layout (location = 0) uniform int source_level;
+
+float source_fetch(ivec2 position, ivec2 size)
+{
+	return texelFetch(source, min(position, size - 1), source_level).r;
+}
+
+void main()
+{
+	ivec2 position = ivec2(gl_GlobalInvocationID.xy);
+	ivec2 size = imageSize(destination);
+
+	if (any(greaterThanEqual(position, size)))
+	{
+		return;
+	}
+
+	ivec2 source_size = textureSize(source, source_level);
+	ivec2 source_position = position * 2;
+
+	float depth = max(
+		max(source_fetch(source_position, source_size), source_fetch(source_position + ivec2(1, 0), source_size)),
+		max(source_fetch(source_position + ivec2(0, 1), source_size), source_fetch(source_position + ivec2(1, 1), source_size)));
+
+	// An odd source has one more row or column than twice the destination.
+	// The last destination texel covers it too.
+	bool extra_x = (source_size.x & 1) != 0 && position.x == size.x - 1;
+	bool extra_y = (source_size.y & 1) != 0 && position.y == size.y - 1;
+
+	if (extra_x)
+	{
+		depth = max(depth, max(source_fetch(source_position + ivec2(2, 0), source_size), source_fetch(source_position + ivec2(2, 1), source_size)));
+	}
+
+	if (extra_y)
+	{
+		depth = max(depth, max(source_fetch(source_position + ivec2(0, 2), source_size), source_fetch(source_position + ivec2(1, 2), source_size)));
+	}
+
+	if (extra_x && extra_y)
+	{
+		depth = max(depth, source_fetch(source_position + ivec2(2, 2), source_size));
+	}
+
+	imageStore(destination, position, vec4(depth));
+}
@@ -1,6 +1,6 @@
-#version 330
+#version 450
 
-#extension GL_ARB_explicit_uniform_location : enable
+#extension GL_ARB_shader_draw_parameters : require
 
 const vec3 normal_table[6] = vec3[6](
 	vec3(0.0, -1.0, 0.0),
@@ -11,30 +11,58 @@ const vec3 normal_table[6] = vec3[6](
 	vec3(1.0, 0.0, 0.0)
 );
 
+// Brightness of each baked ambient occlusion level, from a corner hidden by
+// two neighbours to an unoccluded one.
+const float occlusion_table[4] = float[4](0.5, 0.65, 0.8, 1.0);
+
 const float ambient_strength = 0.8;
 const vec3 light_color = vec3(1.0, 1.0, 1.0);
 const vec3 light_direction = -vec3(0.0, -1.0, 0.0);
 
-//layout (location = 0) uniform mat4 projection;
-//layout (location = 4) uniform mat4 modelview;
-//layout (location = 8) uniform mat3 normalmat;
+// Matches struct renderer_chunk.
+struct chunk
+{
+	ivec4 origin;
+};
+
+layout (location = 0) uniform mat4 matrix_vp;
+
+// The mesher's VBO.  Each vertex is two words: x, y, z, normal and occlusion
+// bytes, then r, g, b, a.  gl_VertexID includes the draw's base vertex.
+layout (std430, binding = 0) readonly buffer vertices
+{
+	uvec2 vertex_data[];
+};
 
-layout (location = 0) in ivec4 vertex_position;
-layout (location = 1) in vec4 vertex_color;
-layout (location = 2) in mat4 matrix_mvp;
+// One record per drawn chunk, selected by the draw's base instance.
+layout (std430, binding = 1) readonly buffer chunks
+{
+	chunk chunk_data[];
+};
 
 out vec4 color;
 
 void main()
 {
+	uvec2 vertex = vertex_data[gl_VertexID];
+
+	vec3 position = vec3(
+		float(vertex.x & 255u),
+		float((vertex.x >> 8u) & 255u),
+		float((vertex.x >> 16u) & 255u));
+
+	// The normal is in the low 3 bits and the occlusion above it.
+	uint normal = (vertex.x >> 24u) & 7u;
+	uint occlusion = vertex.x >> 27u;
+
+	vec4 vertex_color = unpackUnorm4x8(vertex.y);
+
 	vec3 ambient = ambient_strength * light_color;
 
 	// This works for our directional light and the chunks not being rotated, but the normal will need to be transformed with the normal matrix for other lights.
-	vec3 diffuse = max(dot(normal_table[vertex_position.w], light_direction), 0.0) * light_color;
+	vec3 diffuse = max(dot(normal_table[normal], light_direction), 0.0) * light_color;
 
-	color = vec4((ambient + diffuse) * vertex_color.rgb, 1.0);
+	color = vec4((ambient + diffuse) * occlusion_table[occlusion] * vertex_color.rgb, 1.0);
 
-	//gl_Position = projection * modelview * vec4(vertex_position.xyz, 1.0);
-	//gl_Position = projection * matrix_modelview * vec4(vertex_position.xyz, 1.0);
-	gl_Position = matrix_mvp * vec4(vertex_position.xyz, 1.0);
+	gl_Position = matrix_vp * vec4(vec3(chunk_data[gl_BaseInstanceARB].origin.xyz) + position, 1.0);
 }
@@ -0,0 +1,75 @@
+#version 450
+
+#extension GL_ARB_shader_draw_parameters : require
+
+// Counterpart of terrain.vert.glsl for VOXEL_COMPACT_VERTICES.  See
+// chunk_mesh.h for the vertex layout.
+
+const vec3 normal_table[6] = vec3[6](
+	vec3(0.0, -1.0, 0.0),
+	vec3(0.0, 1.0, 0.0),
+	vec3(0.0, 0.0, -1.0),
+	vec3(0.0, 0.0, 1.0),
+	vec3(-1.0, 0.0, 0.0),
+	vec3(1.0, 0.0, 0.0)
+);
+
+// Brightness of each baked ambient occlusion level, from a corner hidden by
+// two neighbours to an unoccluded one.
+const float occlusion_table[4] = float[4](0.5, 0.65, 0.8, 1.0);
+
+const float ambient_strength = 0.8;
+const vec3 light_color = vec3(1.0, 1.0, 1.0);
+const vec3 light_direction = -vec3(0.0, -1.0, 0.0);
+
+// Filled from mesher_palette_get().
+layout (std140) uniform palette
+{
+	vec4 palette_colors[256];
+};
+
+// Matches struct renderer_chunk.
+struct chunk
+{
+	ivec4 origin;
+};
+
+layout (location = 0) uniform mat4 matrix_vp;
+
+// The mesher's VBO, one word per vertex.  gl_VertexID includes the draw's base
+// vertex.
+layout (std430, binding = 0) readonly buffer vertices
+{
+	uint vertex_data[];
+};
+
+// One record per drawn chunk, selected by the draw's base instance.
+layout (std430, binding = 1) readonly buffer chunks
+{
+	chunk chunk_data[];
+};
+
+out vec4 color;
+
+void main()
+{
+	uint vertex_packed = vertex_data[gl_VertexID];
+
+	vec3 position = vec3(
+		float(vertex_packed & 63u),
+		float((vertex_packed >> 6u) & 63u),
+		float((vertex_packed >> 12u) & 63u));
+
+	uint normal = (vertex_packed >> 18u) & 7u;
+	uint occlusion = (vertex_packed >> 21u) & 3u;
+	uint color_index = (vertex_packed >> 23u) & 255u;
+
+	vec3 ambient = ambient_strength * light_color;
+
+	// This works for our directional light and the chunks not being rotated, but the normal will need to be transformed with the normal matrix for other lights.
+	vec3 diffuse = max(dot(normal_table[normal], light_direction), 0.0) * light_color;
+
+	color = vec4((ambient + diffuse) * occlusion_table[occlusion] * palette_colors[color_index].rgb, 1.0);
+
+	gl_Position = matrix_vp * vec4(vec3(chunk_data[gl_BaseInstanceARB].origin.xyz) + position, 1.0);
+}
@@ -1,8 +1,15 @@
 #pragma once
 
+#include "inline.h"
+
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
 typedef int BITSET_BLOCK;
 
 #define BITSET_BLOCK_SIZE (sizeof(BITSET_BLOCK) * 8)
@@ -24,3 +31,56 @@ void bitset_bit_set(struct bitset* bitset, int index);
 void bitset_bit_clear(struct bitset* bitset, int index);
 
 bool bitset_bit_get(struct bitset* bitset, int index);
+
+// Index of the lowest set bit.  value must not be 0.
+static INLINE int bit_scan_forward64(uint64_t value)
+{
+#if defined(_MSC_VER) && defined(_M_X64)
+	unsigned long index = 0;
+	_BitScanForward64(&index, value);
+
+	return (int)index;
+#elif defined(_MSC_VER)
+	// No 64-bit scan on 32-bit targets.
+	unsigned long index = 0;
+
+	if (_BitScanForward(&index, (unsigned long)value) != 0)
+	{
+		return (int)index;
+	}
+
+	_BitScanForward(&index, (unsigned long)(value >> 32));
+
+	return (int)index + 32;
+#else
+	return __builtin_ctzll(value);
+#endif
+}
+
+// Index of the highest set bit.  value must not be 0.
+static INLINE int bit_scan_reverse64(uint64_t value)
+{
+#if defined(_MSC_VER) && defined(_M_X64)
+	unsigned long index = 0;
+	_BitScanReverse64(&index, value);
+
+	return (int)index;
+#elif defined(_MSC_VER)
+	unsigned long index = 0;
+
+	if (_BitScanReverse(&index, (unsigned long)(value >> 32)) != 0)
+	{
+		return (int)index + 32;
+	}
+
+	_BitScanReverse(&index, (unsigned long)value);
+
+	return (int)index;
+#else
+	return 63 - __builtin_clzll(value);
+#endif
+}
+
+// Transposes a 64x64 bit matrix in place, so that afterwards bit j of row i is
+// what bit i of row j was.
+void bit_transpose64(uint64_t* rows);
@@ -18,6 +18,44 @@
 #define CHUNK_SLICE_EX (CHUNK_LENGTH_EX * CHUNK_LENGTH_EX)
 #define CHUNK_VOLUME_EX (CHUNK_LENGTH_EX * CHUNK_LENGTH_EX * CHUNK_LENGTH_EX)
 
+#define CHUNK_PALETTE_CAPACITY 256
+
+// Meshes can be built at 1, 2, 4 or 8 voxels per cell, LOD 0 to 3.
+#define CHUNK_LOD_MAX 3
+
+// Set by the generator.
+enum chunk_contents
+{
+	CHUNK_CONTENTS_MIXED,
+
+	// Every voxel, apron included, is air.
+	CHUNK_CONTENTS_AIR,
+
+	// Every voxel, apron included, is solid.
+	CHUNK_CONTENTS_SOLID,
+
+	// The chunk is solid but air touches it through the apron, so only its
+	// outer shell of voxels can have faces.
+	CHUNK_CONTENTS_SOLID_EXPOSED,
+};
+
+// Palette compressed voxels, apron included.  Each voxel is an index into the
+// palette packed into 0, 1, 2, 4 or 8 bits, the fewest that can address every
+// palette entry.  With 0 bits every voxel is palette entry 0, which is how
+// uniform chunks, solid ones included, are stored without any data.  Otherwise
+// entry 0 is always air.  Use the chunk_voxel* functions rather than touching
+// this directly.
+struct chunk_voxels
+{
+	int bits;
+
+	int palette_length;
+	struct color palette[CHUNK_PALETTE_CAPACITY];
+
+	unsigned char* data;
+	size_t data_length;
+};
+
 struct chunk
 {
 	int key;
@@ -26,22 +64,75 @@ struct chunk
 	int y;
 	int z;
 
-	//struct aabb aabb;
-	GLKVector3 corners[8];
+	// Bounds in voxels.
+	struct aabb aabb;
+
+	// The renderer's record of the chunk for culling on the GPU, or -1.
+	int render_slot;
+
+	// The world's visibility search reached the chunk in search visit_search,
+	// entering through face visit_face, or -1 for the camera's chunk.  Bit n
+	// of visit_directions is set for every face n the search stepped through
+	// on the way.
+	unsigned int visit_search;
+	int visit_face;
+	int visit_directions;
 
 	struct transform transform;
 	struct chunk_mesh* mesh;
 
-	char blocks[CHUNK_VOLUME_EX];
-	struct color colors[CHUNK_VOLUME];
+	// Level of detail of mesh, and the level the mesher is asked to build.
+	int lod;
+	int lod_requested;
+
+	// Set while an active chunk is being meshed again at lod_requested.  The
+	// old mesh keeps being drawn and the new one is left in remesh for the
+	// world to swap in.
+	bool remeshing;
+	struct chunk_mesh* remesh;
+
+	enum chunk_contents contents;
+
+	// When the chunk was handed to the generator.  See timer_seconds().
+	double time_queued;
+
+	struct chunk_voxels voxels;
 };
 
 void chunk_init(struct chunk* chunk, int x, int y, int z);
 
+// Frees the voxel storage.
+void chunk_free(struct chunk* chunk);
+
+// Sets every voxel, apron included, to air.
 void chunk_clear(struct chunk* chunk);
 
+// Sets every voxel, apron included, to color.
+void chunk_voxels_fill(struct chunk* chunk, struct color color);
+
+// Replaces the voxels, apron included, with CHUNK_VOLUME_EX palette indices in
+// chunk_index_ex_get() order.  palette[0] must be air.
+void chunk_voxels_pack(struct chunk* chunk, const unsigned char* indices, const struct color* palette, int palette_length);
+
+// Expands the voxels, apron included, into CHUNK_VOLUME_EX palette indices in
+// chunk_index_ex_get() order, and copies the palette they index into palette,
+// which must hold CHUNK_PALETTE_CAPACITY colors.  Index 0 is air, even for a
+// uniformly solid chunk.  Returns the palette's length.
+int chunk_voxels_unpack(const struct chunk* chunk, unsigned char* indices, struct color* palette);
+
+// Coordinates range from -1 to CHUNK_LENGTH to reach the apron.
+struct color chunk_voxel_get(const struct chunk* chunk, int x, int y, int z);
+
+// Returns false if the palette is full and does not contain color.
+bool chunk_voxel_set(struct chunk* chunk, int x, int y, int z, struct color color);
+
 int chunk_calculate_key(int x, int y, int z);
 
 extern INLINE int chunk_index_get(int x, int y, int z);
 
 extern INLINE int chunk_index_ex_get(int x, int y, int z);
+
+// Faces are numbered in chunk_mesh normal order: -y, +y, -z, +z, -x and +x.
+// Returns the bit of chunk_mesh.connectivity for faces a and b, which must
+// differ.
+extern INLINE int chunk_face_pair_bit(int a, int b);
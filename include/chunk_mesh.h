@@ -2,22 +2,100 @@
 
 #include <GL/glew.h>
 
+#include <stdint.h>
+
+// Every face is a quad of 4 vertices, drawn as two triangles through the
+// renderer's shared quad index buffer.
+//
+// Vertices are 8 bytes: x, y, z, normal and ambient occlusion, r, g, b, a.
+// Defining VOXEL_COMPACT_VERTICES packs them into 32 bits instead, laid out
+// below, with the color an index into the mesher's shared palette (see
+// mesher_palette_get()) and terrain_compact.vert.glsl unpacking them.
+#if defined(VOXEL_COMPACT_VERTICES)
+#define CHUNK_MESH_VERTEX_SIZE 4
+
+// 6 bits per position axis, 3 for the normal, 2 for ambient occlusion and 8
+// for the color.  The top bit is unused.
+#define CHUNK_MESH_X_SHIFT 0
+#define CHUNK_MESH_Y_SHIFT 6
+#define CHUNK_MESH_Z_SHIFT 12
+#define CHUNK_MESH_NORMAL_SHIFT 18
+#define CHUNK_MESH_AO_SHIFT 21
+#define CHUNK_MESH_COLOR_SHIFT 23
+#else
+#define CHUNK_MESH_VERTEX_SIZE 8
+
+// Ambient occlusion shares the normal byte, above the normal's 3 bits.
+#define CHUNK_MESH_AO_SHIFT 3
+#endif
+
+#define CHUNK_MESH_QUAD_SIZE (4 * CHUNK_MESH_VERTEX_SIZE)
+
+// Ambient occlusion levels run from 0, fully occluded, to CHUNK_MESH_AO_NONE.
+#define CHUNK_MESH_AO_NONE 3
+
+// Every pair of faces connected, see chunk_mesh.connectivity.
+#define CHUNK_MESH_CONNECTIVITY_ALL 0x7FFF
+
+// Most quads a chunk can produce: a 3D checkerboard exposes all 6 faces of
+// half of its 32^3 voxels.
+#define CHUNK_MESH_QUADS_MAX (32 * 32 * 32 / 2 * 6)
+
 struct chunk_mesh;
+struct mesh_heap_block;
 
 typedef void(*chunk_mesh_release_func)(void*);
 
+// A run of completely solid voxel layers across a chunk, from layer begin to
+// end - 1 along one axis.  Empty when begin equals end.
+struct chunk_mesh_occluder
+{
+	unsigned char begin;
+	unsigned char end;
+};
+
 struct chunk_mesh
 {
+	// First vertex in the shared VBO, drawn as the base vertex.
 	GLint first;
+
+	// Vertices, 4 per quad.
 	GLsizei count;
 
+	// Indices into the shared quad index buffer, 6 per quad.
+	GLsizei index_count;
+
+	// The vertices facing each normal, stored back to back in normal order so
+	// the renderer can skip the directions facing away from the camera.
+	struct
+	{
+		GLint first;
+		GLsizei count;
+	} faces[6];
+
+	// The longest run of solid layers along x, y and z, which the renderer
+	// draws as occluders.  Found after downsampling, so they match the
+	// surfaces the mesh draws.
+	struct chunk_mesh_occluder occluders[3];
+
+	// One bit per pair of the chunk's faces that air inside the chunk
+	// connects, see chunk_face_pair_bit().  Found after downsampling, like
+	// the occluders.
+	unsigned short connectivity;
+
 	chunk_mesh_release_func release;
 
 	// DO NOT access private data members from outside the mesher.
 	struct
 	{
-		size_t offset;
-		size_t length;
-		int released;
+		struct mesh_heap_block* block;
+
+		// Chunks with identical voxels share one mesh.  hash is the mesh's key
+		// in the mesher's cache and references counts the chunks holding it.
+		uint64_t hash;
+		int references;
+
+		// Next mesh waiting for the GPU to finish with it.
+		struct chunk_mesh* next;
 	} private;
 };
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "chunk.h"
+#include "queue.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#define CHUNK_POOL_SLAB_LENGTH 256
+
+// Hands out chunks from slabs allocated on demand.  Released chunks are kept
+// in a FIFO outside the chunks themselves rather than an intrusive freelist,
+// so nothing in a chunk is overwritten while it sits in the pool, and the
+// least recently released chunk is handed out first.  Not thread safe.
+struct chunk_pool
+{
+	// Most chunks the pool will allocate.
+	size_t capacity;
+
+	struct chunk** slabs;
+	size_t slab_count;
+
+	// Chunks not in use.
+	struct queue available;
+};
+
+void chunk_pool_init(struct chunk_pool* pool, size_t capacity);
+
+void chunk_pool_free(struct chunk_pool* pool);
+
+// Returns NULL once capacity chunks are in use.
+struct chunk* chunk_pool_acquire(struct chunk_pool* pool);
+
+void chunk_pool_release(struct chunk_pool* pool, struct chunk* chunk);
+
+// Frees the voxel storage of unused chunks and whole slabs of unused chunks,
+// keeping at least keep chunks available.
+void chunk_pool_trim(struct chunk_pool* pool, size_t keep);
+
+// Chunks currently allocated in slabs.
+size_t chunk_pool_allocated(struct chunk_pool* pool);
@@ -0,0 +1,4 @@
+#pragma once
+
+// Number of logical processors available to the process.  Always at least 1.
+int cpu_count(void);
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "GLKMath.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+// Planes of a view frustum with their normals pointing inwards.  A point p is
+// on the inside of plane i when dot(planes[i].xyz, p) + planes[i].w >= 0.
+// Left, right, bottom, top, near and far.
+struct frustum
+{
+	GLKVector4 planes[6];
+};
+
+// Axis aligned boxes as a structure of arrays, so several are tested at once.
+// center[axis][i] and extent[axis][i] are box i's center and half size.
+struct frustum_boxes
+{
+	const float* center[3];
+	const float* extent[3];
+	size_t count;
+};
+
+// Extracts the planes bounding clip space from a view-projection matrix, in
+// the coordinates the matrix transforms from.
+void frustum_extract(struct frustum* frustum, GLKMatrix4 matrix);
+
+// Writes the index of every box that intersects the frustum to visible, in
+// order, and returns how many were written.  Conservative: boxes just outside
+// the frustum near its corners may be counted as visible.
+size_t frustum_cull_boxes(const struct frustum* frustum, const struct frustum_boxes* boxes, uint32_t* visible);
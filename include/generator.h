@@ -4,8 +4,17 @@
 
 #include <stdbool.h>
 
-bool generator_start_thread(void);
+// Starts a pool of workers sharing one work queue.  A thread_count of 0 or
+// less sizes the pool from the number of processors.
+bool generator_start_threads(int thread_count);
 
-void generator_stop_thread(void);
+void generator_stop_threads(void);
 
 void generator_queue_work(struct chunk* chunk);
+
+size_t generator_chunks_generated(void);
+
+// Chunks that were all air or all solid and skipped the mesher.
+size_t generator_chunks_uniform(void);
+
+void generator_heightmap_stats(size_t* hits, size_t* misses);
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// Sizes are rounded up to a multiple of this, which every vertex size
+// divides.
+#define MESH_HEAP_GRANULARITY 256
+
+// Two level segregated fit size classes.  The first level is the power of
+// two below the size and the second splits each power of two into
+// MESH_HEAP_SL_COUNT linear steps.
+#define MESH_HEAP_FL_COUNT 48
+#define MESH_HEAP_SL_BITS 4
+#define MESH_HEAP_SL_COUNT (1 << MESH_HEAP_SL_BITS)
+
+// A range of the heap, either allocated or free.
+struct mesh_heap_block
+{
+	size_t offset;
+	size_t size;
+	bool free;
+
+	// Neighbours in address order.
+	struct mesh_heap_block* previous;
+	struct mesh_heap_block* next;
+
+	// Neighbours in the free list of the block's size class.  Unused
+	// descriptors are chained through free_next.
+	struct mesh_heap_block* free_previous;
+	struct mesh_heap_block* free_next;
+};
+
+struct mesh_heap_stats
+{
+	size_t capacity;
+	size_t used;
+	size_t allocations;
+
+	// Free space is fragmented when the largest free block is much smaller
+	// than the total.
+	size_t free;
+	size_t free_blocks;
+	size_t free_largest;
+};
+
+// Sub-allocates offsets into a buffer the heap never touches, such as a
+// persistently mapped VBO.  Block descriptors live in a separate array, so
+// the buffer may be write only.  Allocating and releasing are O(1) and free
+// neighbours are coalesced on release.  Not thread safe.
+struct mesh_heap
+{
+	size_t capacity;
+
+	struct mesh_heap_block* blocks;
+	size_t block_capacity;
+	struct mesh_heap_block* unused;
+
+	// Bit fl of fl_bitmap is set when any list in sl_bitmaps[fl] is not
+	// empty, and bit sl of sl_bitmaps[fl] when free_lists[fl][sl] is not.
+	uint64_t fl_bitmap;
+	uint32_t sl_bitmaps[MESH_HEAP_FL_COUNT];
+	struct mesh_heap_block* free_lists[MESH_HEAP_FL_COUNT][MESH_HEAP_SL_COUNT];
+
+	size_t used;
+	size_t allocations;
+	size_t free_blocks;
+};
+
+// block_capacity bounds the number of allocated and free blocks together.
+void mesh_heap_init(struct mesh_heap* heap, size_t capacity, size_t block_capacity);
+
+void mesh_heap_free(struct mesh_heap* heap);
+
+// Returns NULL when no free block is large enough.
+struct mesh_heap_block* mesh_heap_allocate(struct mesh_heap* heap, size_t size);
+
+void mesh_heap_release(struct mesh_heap* heap, struct mesh_heap_block* block);
+
+void mesh_heap_stats_get(struct mesh_heap* heap, struct mesh_heap_stats* stats);
@@ -1,20 +1,103 @@
 #pragma once
 
 #include "chunk.h"
+#include "mesh_heap.h"
 
 #include <GL/glew.h>
 
 #include <stdbool.h>
 
-bool mesher_start_thread(void);
+enum mesher_mode
+{
+	// Two triangles per exposed voxel face.
+	MESHER_MODE_NAIVE,
 
-void mesher_stop_thread(void);
+	// Coplanar faces of the same color merged into rectangles.
+	MESHER_MODE_GREEDY,
 
+	// Faces found with bit operations on occupancy rows, one quad per face.
+	MESHER_MODE_BINARY,
+
+	// Faces found with bit operations and merged like MESHER_MODE_GREEDY.
+	MESHER_MODE_BINARY_GREEDY,
+
+	MESHER_MODE_COUNT,
+};
+
+struct mesher_cache_stats
+{
+	// Chunks given an existing mesh, and chunks whose mesh was uploaded.
+	size_t hits;
+	size_t misses;
+
+	// Distinct meshes currently shared through the cache.
+	size_t meshes;
+};
+
+struct mesher_stats
+{
+	// Chunks meshed and vertex bytes produced since the threads were started.
+	size_t meshed;
+	size_t meshed_bytes;
+
+	// Time spent building meshes summed over the workers, excluding the copy
+	// into the VBO.
+	double mesh_seconds;
+
+	// Occupancy and fragmentation of the VBO.
+	struct mesh_heap_stats heap;
+
+	struct mesher_cache_stats cache;
+};
+
+// Starts a pool of workers that build meshes in parallel and one uploader
+// thread that copies them into the VBO.  A thread_count of 0 or less
+// sizes the pool from the number of processors.
+bool mesher_start_threads(int thread_count);
+
+void mesher_stop_threads(void);
+
+// Meshes the chunk at chunk->lod_requested and hands it to world_add_chunk().
+// Chunks whose voxels and palette match a chunk already holding a mesh are
+// given that mesh instead of being meshed again.
+// Set chunk->remeshing to mesh an active chunk again; see struct chunk.
 void mesher_queue_work(struct chunk* chunk);
 
+// Drops the chunk's reference to its mesh, which is freed once no chunk
+// holds it.
 // TODO:  Now called using function ptr.  Remove me.
 void mesher_release_mesh(struct chunk* chunk);
 
 //GLuint mesher_vao_get(void);
 
+#ifdef VOXEL_HEADLESS
+// Backs the mesh heap with system memory instead of a mapped VBO.
+void mesher_setup_memory_buffer(void);
+#else
 void mesher_setup_opengl_buffer(void);
+
+// The buffer every mesh's vertices live in, read by the terrain shaders as a
+// shader storage buffer.  Vertices are CHUNK_MESH_VERTEX_SIZE bytes apart and
+// chunk_mesh.first counts vertices from its start.
+GLuint mesher_vbo_get(void);
+
+// Call once per frame after submitting the frame's draws.  Meshes released
+// since the previous call are reclaimed once the GPU has finished every frame
+// submitted so far.  Never blocks.  Main thread only.
+void mesher_fence_frame(void);
+#endif
+
+void mesher_stats_get(struct mesher_stats* stats);
+
+// Thread safe.  Applies to chunks meshed from now on; meshes already built are
+// kept.
+void mesher_mode_set(enum mesher_mode mode);
+
+enum mesher_mode mesher_mode_get(void);
+
+#if defined(VOXEL_COMPACT_VERTICES)
+// Copies the palette compact vertices index into colors, which must hold
+// CHUNK_PALETTE_CAPACITY entries.  Returns a version that changes whenever an
+// entry is added.
+unsigned int mesher_palette_get(struct color* colors);
+#endif
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "aabb.h"
+#include "GLKMath.h"
+
+#include <stdbool.h>
+
+// Size of the software depth buffer.  Both must be powers of two.
+#define OCCLUSION_WIDTH 256
+#define OCCLUSION_HEIGHT 128
+
+// Levels down to 1x1, level 0 included.
+#define OCCLUSION_LEVELS 9
+
+// Texels in every level together.
+#define OCCLUSION_PYRAMID_SIZE (OCCLUSION_WIDTH * OCCLUSION_HEIGHT * 4 / 3 + 1)
+
+// A low resolution depth buffer that occluders are rasterized into on the
+// CPU, so boxes hidden behind them can be rejected before any draw command
+// is built and without reading anything back from the GPU.
+//
+// Depth is stored as 1 / w, which is linear in screen space and grows
+// towards the camera, with 0 where nothing has been drawn.  Occluders are
+// rasterized conservatively: level 0 holds, per texel, the furthest depth
+// of the nearest occluder covering the whole texel.  Each level after it
+// holds the furthest of the 2x2 texels below, so a box nearer than none of
+// them is hidden.
+struct occlusion_buffer
+{
+	GLKMatrix4 matrix_vp;
+	GLKVector3 eye;
+
+	float depth[OCCLUSION_PYRAMID_SIZE];
+};
+
+// Clears the buffer for a new view.  eye is the camera position.
+void occlusion_begin(struct occlusion_buffer* buffer, GLKMatrix4 matrix_vp, GLKVector3 eye);
+
+// Draws the faces of a solid box that face the eye.  Boxes reaching behind
+// the eye are skipped, as they cannot be projected.
+void occlusion_rasterize_box(struct occlusion_buffer* buffer, struct aabb box);
+
+// Builds the levels after 0 once every occluder has been drawn.
+void occlusion_build_pyramid(struct occlusion_buffer* buffer);
+
+// Returns false only when the box is hidden behind the occluders.
+bool occlusion_test_box(const struct occlusion_buffer* buffer, struct aabb box);
@@ -27,6 +27,7 @@ int simplex(int64_t seed, struct osn_context **ctx);
 void simplex_free(struct osn_context *ctx);
 int simplex_init_perm(struct osn_context *ctx, int16_t p[], int nelements);
 double simplex2(struct osn_context *ctx, double x, double y);
+void simplex2_batch(struct osn_context *ctx, const float *x, const float *y, float *out, int count);
 double simplex3(struct osn_context *ctx, double x, double y, double z);
 double simplex4(struct osn_context *ctx, double x, double y, double z, double w);
 
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "tinycthread.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+// Bounded multi-producer multi-consumer queue.  Producers block while the
+// queue is full and consumers block while it is empty.  Closing the queue
+// wakes every waiting thread so workers can be shut down and joined.
+struct queue_blocking
+{
+	mtx_t mutex;
+	cnd_t not_empty;
+	cnd_t not_full;
+
+	bool closed;
+
+	size_t capacity;
+	size_t count;
+	size_t front;
+	size_t back;
+	void** elements;
+};
+
+void queue_blocking_init(struct queue_blocking* queue, size_t capacity);
+
+void queue_blocking_free(struct queue_blocking* queue);
+
+// Wakes all blocked producers and consumers.  Subsequent pushes and pops fail
+// immediately.
+void queue_blocking_close(struct queue_blocking* queue);
+
+// Blocks until there is room.  Returns false if the queue was closed.
+bool queue_blocking_push(struct queue_blocking* queue, void* element);
+
+// Blocks until every element has been pushed.  Returns the number of elements
+// pushed, which is less than count only if the queue was closed.
+size_t queue_blocking_push_batch(struct queue_blocking* queue, void** elements, size_t count);
+
+// Blocks until an element is available.  Returns NULL if the queue was closed.
+void* queue_blocking_pop(struct queue_blocking* queue);
+
+// Blocks until at least one element is available and pops up to max_count.
+// Returns 0 if the queue was closed.
+size_t queue_blocking_pop_batch(struct queue_blocking* queue, void** elements, size_t max_count);
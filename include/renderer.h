@@ -4,10 +4,33 @@
 
 #include "sprite.h"
 
+struct chunk;
+
 bool renderer_initialize(void);
 
 void renderer_render(void);
 
 void renderer_update(void);
 
+// Submits the chunk for this frame.  Chunks outside the view frustum or
+// hidden behind nearer terrain are dropped when the frame is rendered.  Does
+// nothing while culling on the GPU.
 void render_chunk(struct chunk* chunk);
+
+// Keep the chunk's record for culling on the GPU in step with its mesh.  Call
+// update whenever chunk->mesh changes and remove before the chunk is
+// unloaded.
+void renderer_chunk_update(struct chunk* chunk);
+
+void renderer_chunk_remove(struct chunk* chunk);
+
+// Culling on the GPU is on by default where GL_ARB_indirect_parameters is
+// supported.  Otherwise chunks are culled on the CPU.
+bool renderer_gpu_culling_get(void);
+
+void renderer_gpu_culling_set(bool enabled);
+
+// Occlusion culling in software when culling on the CPU, on by default.
+bool renderer_occlusion_culling_get(void);
+
+void renderer_occlusion_culling_set(bool enabled);
@@ -9,4 +9,8 @@ typedef GLuint SHADER;
 
 SHADER shader_create(const char* vert_path, const char* frag_path);
 
+// Builds a program from a single compute shader.  Dispatch it with
+// glDispatchCompute() after shader_use().
+SHADER shader_create_compute(const char* comp_path);
+
 void shader_use(SHADER shader);
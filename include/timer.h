@@ -0,0 +1,5 @@
+#pragma once
+
+// Seconds elapsed since an arbitrary fixed point.  Only useful for measuring
+// intervals.
+double timer_seconds(void);
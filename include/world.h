@@ -1,6 +1,7 @@
 #pragma once
 
 #include "chunk.h"
+#include "chunk_pool.h"
 #include "khash.h"
 #include "queue.h"
 #include "queue_safe.h"
@@ -11,18 +12,30 @@ KHASH_MAP_INIT_INT(32, void*)
 
 KHASH_MAP_INIT_INT(pending, int)
 
-struct world
+struct world_stats
 {
-	// TODO:  chunk_buffer and chunks_available can be combined into a pool.
-	// (NO freelist.  We don't want to accidentally overwrite data in the chunk
-	// that is preserved between uses.  For example the VBO.  Freelist may be an
-	// option if per chunk VBOs get switched to a single shared VBO)
+	// Chunks that have been inserted into chunks_active.
+	size_t chunks_activated;
+
+	// Seconds between load_chunk and insertion into chunks_active.
+	double latency_total;
+	double latency_max;
+
+	// Chunks allocated by the pool, in use or not.
+	size_t chunks_allocated;
 
-	// Chunk buffer.
-	struct chunk* chunk_buffer;
+	// Active chunks meshed again after crossing a level of detail band.
+	size_t chunks_remeshed;
+};
 
-	// Chunks that have been initialized and are available for use.
-	struct queue chunks_available;
+struct world
+{
+	// Chunks not in the world or being processed.  The pool does not use a
+	// freelist so data preserved in a chunk between uses is never overwritten.
+	struct chunk_pool chunk_pool;
+
+	// When the pool last gave back memory.  See timer_seconds().
+	double time_pool_trimmed;
 
 	// Chunks that have been processed and are ready to be made active.
 	// This is a thread safe place for processed chunks to be dropped off until
@@ -31,6 +44,12 @@ struct world
 
 	khash_t(32)* chunks_active;
 
+	// Breadth first search for the chunks visible from the camera's chunk,
+	// run once per tick.  visit_search numbers the searches, see
+	// chunk.visit_search.
+	struct queue chunks_visible;
+	unsigned int visit_search;
+
 	khash_t(pending)* chunks_pending;
 
 	int chunk_radius;
@@ -38,6 +57,8 @@ struct world
 
 	int player_chunk_x;
 	int player_chunk_z;
+
+	struct world_stats stats;
 };
 
 void world_init(void);
@@ -46,5 +67,10 @@ void world_free(void);
 
 void world_tick(void);
 
+void world_stats_get(struct world_stats* stats);
+
+// Chunks further than this from the player on x or z are not drawn.
+int world_chunk_radius_get(void);
+
 // Thead safe.
 void world_add_chunk(struct chunk* chunk);
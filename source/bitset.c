@@ -52,3 +52,20 @@ bool bitset_bit_get(struct bitset* bitset, int index)
 
 	return bitset->buffer[element] & (1 << offset);
 }
+
+void bit_transpose64(uint64_t* rows)
+{
+	// Swaps ever smaller off-diagonal blocks: 32x32, then 16x16, down to 1x1.
+	uint64_t mask = 0x00000000FFFFFFFFull;
+
+	for (int j = 32; j != 0; j >>= 1, mask ^= mask << j)
+	{
+		for (int k = 0; k < 64; k = ((k | j) + 1) & ~j)
+		{
+			uint64_t t = ((rows[k] >> j) ^ rows[k | j]) & mask;
+
+			rows[k | j] ^= t;
+			rows[k] ^= t << j;
+		}
+	}
+}
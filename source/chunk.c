@@ -23,33 +23,270 @@ void chunk_init(struct chunk* chunk, int x, int y, int z)
 	chunk->y = y;
 	chunk->z = z;
 
-	//chunk->aabb.min = GLKVector3Make(x * CHUNK_LENGTH, y * CHUNK_LENGTH, z * CHUNK_LENGTH);
-	//chunk->aabb.max = GLKVector3AddScalar(chunk->aabb.min, CHUNK_LENGTH);
+	chunk->contents = CHUNK_CONTENTS_MIXED;
 
-	int xx = x * CHUNK_LENGTH - 1;
-	int zz = z * CHUNK_LENGTH - 1;
-	int d = CHUNK_LENGTH + 1;
+	chunk->lod = 0;
+	chunk->lod_requested = 0;
+	chunk->remeshing = false;
+	chunk->remesh = NULL;
 
-	int miny = y * CHUNK_LENGTH - 1;
-	int maxy = miny + d;
+	chunk->render_slot = -1;
 
-	chunk->corners[0] = GLKVector3Make(x + 0, miny, z + 0);
-	chunk->corners[1] = GLKVector3Make(x + d, miny, z + 0);
-	chunk->corners[2] = GLKVector3Make(x + 0, miny, z + d);
-	chunk->corners[3] = GLKVector3Make(x + d, miny, z + d);
-	chunk->corners[4] = GLKVector3Make(x + 0, maxy, z + 0);
-	chunk->corners[5] = GLKVector3Make(x + d, maxy, z + 0);
-	chunk->corners[6] = GLKVector3Make(x + 0, maxy, z + d);
-	chunk->corners[7] = GLKVector3Make(x + d, maxy, z + d);
+	chunk->visit_search = 0;
+	chunk->visit_face = -1;
+	chunk->visit_directions = 0;
+
+	chunk->aabb.min = GLKVector3Make((float)(x * CHUNK_LENGTH), (float)(y * CHUNK_LENGTH), (float)(z * CHUNK_LENGTH));
+	chunk->aabb.max = GLKVector3AddScalar(chunk->aabb.min, CHUNK_LENGTH);
 
 	transform_init(&chunk->transform);
 	chunk->transform.translation = GLKVector3Make(x * CHUNK_LENGTH, y * CHUNK_LENGTH, z * CHUNK_LENGTH);
 	transform_calc(&chunk->transform);
 }
 
+static bool color_equal(struct color a, struct color b)
+{
+	return a.r == b.r && a.g == b.g && a.b == b.b && a.a == b.a;
+}
+
+static int chunk_voxels_bits(int palette_length)
+{
+	if (palette_length <= 1) return 0;
+	if (palette_length <= 2) return 1;
+	if (palette_length <= 4) return 2;
+	if (palette_length <= 16) return 4;
+
+	return 8;
+}
+
+// Resizes the packed data for the given bits per voxel.  Every voxel divides
+// evenly into bytes since CHUNK_VOLUME_EX is a multiple of 8.
+static void chunk_voxels_resize(struct chunk* chunk, int bits)
+{
+	size_t length = CHUNK_VOLUME_EX / 8 * bits;
+
+	chunk->voxels.bits = bits;
+
+	if (length == chunk->voxels.data_length)
+	{
+		return;
+	}
+
+	if (length == 0)
+	{
+		free(chunk->voxels.data);
+
+		chunk->voxels.data = NULL;
+		chunk->voxels.data_length = 0;
+
+		return;
+	}
+
+	chunk->voxels.data = realloc(chunk->voxels.data, length);
+	check_allocation(chunk->voxels.data);
+
+	chunk->voxels.data_length = length;
+}
+
+// Packs 8 / bits indices per byte, lowest voxel in the lowest bits.  Called
+// with a constant bits so each case unrolls.
+static INLINE void chunk_voxels_encode(unsigned char* data, const unsigned char* indices, int bits)
+{
+	int per_byte = 8 / bits;
+
+	for (int i = 0; i < CHUNK_VOLUME_EX / per_byte; i++)
+	{
+		unsigned char byte = 0;
+
+		for (int j = 0; j < per_byte; j++)
+		{
+			byte |= indices[i * per_byte + j] << (j * bits);
+		}
+
+		data[i] = byte;
+	}
+}
+
+static INLINE void chunk_voxels_decode(unsigned char* indices, const unsigned char* data, int bits)
+{
+	int per_byte = 8 / bits;
+	unsigned char mask = (unsigned char)((1 << bits) - 1);
+
+	for (int i = 0; i < CHUNK_VOLUME_EX / per_byte; i++)
+	{
+		unsigned char byte = data[i];
+
+		for (int j = 0; j < per_byte; j++)
+		{
+			indices[i * per_byte + j] = (byte >> (j * bits)) & mask;
+		}
+	}
+}
+
+void chunk_free(struct chunk* chunk)
+{
+	free(chunk->voxels.data);
+
+	chunk->voxels.data = NULL;
+	chunk->voxels.data_length = 0;
+}
+
 void chunk_clear(struct chunk* chunk)
 {
-	memset(chunk->blocks, 0, CHUNK_VOLUME_EX * sizeof(char));
+	struct color air = { 0 };
+
+	chunk_voxels_fill(chunk, air);
+}
+
+void chunk_voxels_fill(struct chunk* chunk, struct color color)
+{
+	chunk->voxels.palette[0] = color;
+	chunk->voxels.palette_length = 1;
+
+	chunk_voxels_resize(chunk, 0);
+}
+
+void chunk_voxels_pack(struct chunk* chunk, const unsigned char* indices, const struct color* palette, int palette_length)
+{
+	memcpy(chunk->voxels.palette, palette, palette_length * sizeof(struct color));
+	chunk->voxels.palette_length = palette_length;
+
+	chunk_voxels_resize(chunk, chunk_voxels_bits(palette_length));
+
+	switch (chunk->voxels.bits)
+	{
+	case 1: chunk_voxels_encode(chunk->voxels.data, indices, 1); break;
+	case 2: chunk_voxels_encode(chunk->voxels.data, indices, 2); break;
+	case 4: chunk_voxels_encode(chunk->voxels.data, indices, 4); break;
+	case 8: memcpy(chunk->voxels.data, indices, CHUNK_VOLUME_EX); break;
+	}
+}
+
+int chunk_voxels_unpack(const struct chunk* chunk, unsigned char* indices, struct color* palette)
+{
+	struct color air = { 0 };
+
+	// Numbered as if packed with air first, so every voxel is entry 1.
+	if (chunk->voxels.bits == 0 && color_equal(chunk->voxels.palette[0], air) == false)
+	{
+		palette[0] = air;
+		palette[1] = chunk->voxels.palette[0];
+
+		memset(indices, 1, CHUNK_VOLUME_EX);
+
+		return 2;
+	}
+
+	memcpy(palette, chunk->voxels.palette, chunk->voxels.palette_length * sizeof(struct color));
+
+	switch (chunk->voxels.bits)
+	{
+	case 0: memset(indices, 0, CHUNK_VOLUME_EX); break;
+	case 1: chunk_voxels_decode(indices, chunk->voxels.data, 1); break;
+	case 2: chunk_voxels_decode(indices, chunk->voxels.data, 2); break;
+	case 4: chunk_voxels_decode(indices, chunk->voxels.data, 4); break;
+	case 8: memcpy(indices, chunk->voxels.data, CHUNK_VOLUME_EX); break;
+	}
+
+	return chunk->voxels.palette_length;
+}
+
+static int chunk_voxel_index_get(const struct chunk* chunk, int index)
+{
+	int bits = chunk->voxels.bits;
+
+	if (bits == 0)
+	{
+		return 0;
+	}
+
+	int per_byte = 8 / bits;
+	int shift = (index % per_byte) * bits;
+
+	return (chunk->voxels.data[index / per_byte] >> shift) & ((1 << bits) - 1);
+}
+
+struct color chunk_voxel_get(const struct chunk* chunk, int x, int y, int z)
+{
+	int index = chunk_voxel_index_get(chunk, chunk_index_ex_get(x, y, z));
+
+	return chunk->voxels.palette[index];
+}
+
+// Returns the entry holding color, or -1.
+static int chunk_palette_find(const struct color* palette, int palette_length, struct color color)
+{
+	for (int i = 0; i < palette_length; i++)
+	{
+		if (color_equal(palette[i], color) == true)
+		{
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+bool chunk_voxel_set(struct chunk* chunk, int x, int y, int z, struct color color)
+{
+	int palette_index = chunk_palette_find(chunk->voxels.palette, chunk->voxels.palette_length, color);
+
+	if (palette_index == -1)
+	{
+		if (chunk->voxels.palette_length == CHUNK_PALETTE_CAPACITY)
+		{
+			return false;
+		}
+
+		if (chunk_voxels_bits(chunk->voxels.palette_length + 1) == chunk->voxels.bits)
+		{
+			palette_index = chunk->voxels.palette_length;
+
+			chunk->voxels.palette[palette_index] = color;
+			chunk->voxels.palette_length++;
+		}
+		else
+		{
+			// Repack at the wider width.  A uniform chunk unpacks with air
+			// added first, which may be the color being set.
+			unsigned char* indices = malloc(CHUNK_VOLUME_EX);
+			check_allocation(indices);
+
+			struct color palette[CHUNK_PALETTE_CAPACITY];
+			int palette_length = chunk_voxels_unpack(chunk, indices, palette);
+
+			palette_index = chunk_palette_find(palette, palette_length, color);
+
+			if (palette_index == -1)
+			{
+				palette_index = palette_length;
+				palette[palette_length++] = color;
+			}
+
+			chunk_voxels_pack(chunk, indices, palette, palette_length);
+
+			free(indices);
+		}
+	}
+
+	int index = chunk_index_ex_get(x, y, z);
+
+	int bits = chunk->voxels.bits;
+
+	if (bits == 0)
+	{
+		// Every voxel is palette entry 0, which is color.
+		return true;
+	}
+
+	int per_byte = 8 / bits;
+	int shift = (index % per_byte) * bits;
+	unsigned char mask = (unsigned char)(((1 << bits) - 1) << shift);
+
+	unsigned char* byte = &chunk->voxels.data[index / per_byte];
+	*byte = (unsigned char)((*byte & ~mask) | (palette_index << shift));
+
+	return true;
 }
 
 INLINE int chunk_index_get(int x, int y, int z)
@@ -61,3 +298,12 @@ INLINE int chunk_index_ex_get(int x, int y, int z)
 {
 	return (y + 1) * CHUNK_SLICE_EX + (z + 1) * CHUNK_LENGTH_EX + (x + 1);
 }
+
+INLINE int chunk_face_pair_bit(int a, int b)
+{
+	int low = min(a, b);
+	int high = max(a, b);
+
+	// Pairs are counted in order (0, 1), (0, 2) ... (0, 5), (1, 2) and so on.
+	return 1 << (low * (11 - low) / 2 + high - low - 1);
+}
@@ -0,0 +1,164 @@
+#include "chunk_pool.h"
+
+#include "utility.h"
+
+static size_t chunk_pool_slabs_max(struct chunk_pool* pool)
+{
+	return (pool->capacity + CHUNK_POOL_SLAB_LENGTH - 1) / CHUNK_POOL_SLAB_LENGTH;
+}
+
+static bool chunk_pool_grow(struct chunk_pool* pool)
+{
+	if (pool->slab_count == chunk_pool_slabs_max(pool))
+	{
+		return false;
+	}
+
+	// Zeroed so the chunks start without voxel storage or a mesh.
+	struct chunk* slab = calloc(CHUNK_POOL_SLAB_LENGTH, sizeof(struct chunk));
+	check_allocation(slab);
+
+	pool->slabs[pool->slab_count++] = slab;
+
+	for (int i = 0; i < CHUNK_POOL_SLAB_LENGTH; i++)
+	{
+		queue_push(&pool->available, &slab[i]);
+	}
+
+	return true;
+}
+
+static size_t chunk_pool_slab_find(struct chunk_pool* pool, struct chunk* chunk)
+{
+	for (size_t i = 0; i < pool->slab_count; i++)
+	{
+		if (chunk >= pool->slabs[i] && chunk < pool->slabs[i] + CHUNK_POOL_SLAB_LENGTH)
+		{
+			return i;
+		}
+	}
+
+	log_error_exit("Chunk does not belong to the pool.");
+
+	return 0;
+}
+
+void chunk_pool_init(struct chunk_pool* pool, size_t capacity)
+{
+	pool->capacity = capacity;
+	pool->slab_count = 0;
+
+	pool->slabs = malloc(chunk_pool_slabs_max(pool) * sizeof(struct chunk*));
+	check_allocation(pool->slabs);
+
+	queue_init(&pool->available, chunk_pool_slabs_max(pool) * CHUNK_POOL_SLAB_LENGTH);
+}
+
+void chunk_pool_free(struct chunk_pool* pool)
+{
+	for (size_t i = 0; i < pool->slab_count; i++)
+	{
+		for (int j = 0; j < CHUNK_POOL_SLAB_LENGTH; j++)
+		{
+			chunk_free(&pool->slabs[i][j]);
+		}
+
+		free(pool->slabs[i]);
+	}
+
+	free(pool->slabs);
+	queue_free(&pool->available);
+
+	pool->slabs = NULL;
+	pool->slab_count = 0;
+}
+
+struct chunk* chunk_pool_acquire(struct chunk_pool* pool)
+{
+	if (pool->available.count == 0 && chunk_pool_grow(pool) == false)
+	{
+		return NULL;
+	}
+
+	return queue_pop(&pool->available);
+}
+
+void chunk_pool_release(struct chunk_pool* pool, struct chunk* chunk)
+{
+	queue_push(&pool->available, chunk);
+}
+
+void chunk_pool_trim(struct chunk_pool* pool, size_t keep)
+{
+	size_t count = pool->available.count;
+
+	if (count <= keep)
+	{
+		return;
+	}
+
+	struct chunk** chunks = malloc(count * sizeof(struct chunk*));
+	check_allocation(chunks);
+
+	size_t* slab_unused = calloc(pool->slab_count, sizeof(size_t));
+	check_allocation(slab_unused);
+
+	for (size_t i = 0; i < count; i++)
+	{
+		chunks[i] = queue_pop(&pool->available);
+
+		slab_unused[chunk_pool_slab_find(pool, chunks[i])]++;
+	}
+
+	// Pick whole slabs to free, newest first, while enough chunks remain.
+	// Freed slabs are marked by setting their unused count to 0.
+	size_t remaining = count;
+
+	for (size_t i = pool->slab_count; i-- > 0;)
+	{
+		if (slab_unused[i] == CHUNK_POOL_SLAB_LENGTH && remaining - CHUNK_POOL_SLAB_LENGTH >= keep)
+		{
+			remaining -= CHUNK_POOL_SLAB_LENGTH;
+		}
+		else
+		{
+			slab_unused[i] = 0;
+		}
+	}
+
+	// Requeue the survivors in their original order.  Their voxels are dead
+	// until the chunk is generated again, so their storage goes too.
+	for (size_t i = 0; i < count; i++)
+	{
+		chunk_free(chunks[i]);
+
+		if (slab_unused[chunk_pool_slab_find(pool, chunks[i])] == 0)
+		{
+			queue_push(&pool->available, chunks[i]);
+		}
+	}
+
+	size_t slab_count = 0;
+
+	for (size_t i = 0; i < pool->slab_count; i++)
+	{
+		if (slab_unused[i] == CHUNK_POOL_SLAB_LENGTH)
+		{
+			free(pool->slabs[i]);
+		}
+		else
+		{
+			pool->slabs[slab_count++] = pool->slabs[i];
+		}
+	}
+
+	pool->slab_count = slab_count;
+
+	free(slab_unused);
+	free(chunks);
+}
+
+size_t chunk_pool_allocated(struct chunk_pool* pool)
+{
+	return pool->slab_count * CHUNK_POOL_SLAB_LENGTH;
+}
@@ -0,0 +1,21 @@
+#include "cpu.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+int cpu_count(void)
+{
+#if defined(_WIN32)
+	SYSTEM_INFO info = { 0 };
+	GetSystemInfo(&info);
+
+	int count = (int)info.dwNumberOfProcessors;
+#else
+	int count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+
+	return count > 0 ? count : 1;
+}
@@ -0,0 +1,127 @@
+#include "frustum.h"
+
+#include "bitset.h"
+
+#include <math.h>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define FRUSTUM_SSE
+#include <xmmintrin.h>
+#endif
+
+void frustum_extract(struct frustum* frustum, GLKMatrix4 matrix)
+{
+	// Each plane is the sum or difference of the matrix's w row and its x, y
+	// or z row.  Clip space is -w <= x, y, z <= w.
+	for (int i = 0; i < 3; i++)
+	{
+		GLKVector4 row = GLKVector4Make(matrix.m[i], matrix.m[4 + i], matrix.m[8 + i], matrix.m[12 + i]);
+		GLKVector4 row_w = GLKVector4Make(matrix.m[3], matrix.m[7], matrix.m[11], matrix.m[15]);
+
+		frustum->planes[i * 2 + 0] = GLKVector4Add(row_w, row);
+		frustum->planes[i * 2 + 1] = GLKVector4Subtract(row_w, row);
+	}
+}
+
+// A box is outside a plane when even its corner furthest along the plane's
+// normal is behind it.  That corner is center + sign(normal) * extent, so the
+// test is dot(normal, center) + w + dot(abs(normal), extent) < 0.
+static int frustum_box_visible(const struct frustum* frustum, const struct frustum_boxes* boxes, size_t i)
+{
+	for (int p = 0; p < 6; p++)
+	{
+		GLKVector4 plane = frustum->planes[p];
+
+		float distance =
+			plane.x * boxes->center[0][i] +
+			plane.y * boxes->center[1][i] +
+			plane.z * boxes->center[2][i] +
+			plane.w;
+
+		float radius =
+			fabsf(plane.x) * boxes->extent[0][i] +
+			fabsf(plane.y) * boxes->extent[1][i] +
+			fabsf(plane.z) * boxes->extent[2][i];
+
+		if (distance + radius < 0.0f)
+		{
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+size_t frustum_cull_boxes(const struct frustum* frustum, const struct frustum_boxes* boxes, uint32_t* visible)
+{
+	size_t visible_count = 0;
+	size_t i = 0;
+
+#if defined(FRUSTUM_SSE)
+	// Four boxes per iteration against each plane in turn.  A lane's sign
+	// bit is set while its box is outside any plane tested so far.
+	__m128 planes[6][4];
+	__m128 planes_abs[6][3];
+
+	__m128 sign = _mm_set1_ps(-0.0f);
+
+	for (int p = 0; p < 6; p++)
+	{
+		planes[p][0] = _mm_set1_ps(frustum->planes[p].x);
+		planes[p][1] = _mm_set1_ps(frustum->planes[p].y);
+		planes[p][2] = _mm_set1_ps(frustum->planes[p].z);
+		planes[p][3] = _mm_set1_ps(frustum->planes[p].w);
+
+		for (int axis = 0; axis < 3; axis++)
+		{
+			planes_abs[p][axis] = _mm_andnot_ps(sign, planes[p][axis]);
+		}
+	}
+
+	for (; i + 4 <= boxes->count; i += 4)
+	{
+		__m128 center_x = _mm_loadu_ps(&boxes->center[0][i]);
+		__m128 center_y = _mm_loadu_ps(&boxes->center[1][i]);
+		__m128 center_z = _mm_loadu_ps(&boxes->center[2][i]);
+
+		__m128 extent_x = _mm_loadu_ps(&boxes->extent[0][i]);
+		__m128 extent_y = _mm_loadu_ps(&boxes->extent[1][i]);
+		__m128 extent_z = _mm_loadu_ps(&boxes->extent[2][i]);
+
+		__m128 outside = _mm_setzero_ps();
+
+		for (int p = 0; p < 6; p++)
+		{
+			__m128 distance = planes[p][3];
+			distance = _mm_add_ps(distance, _mm_mul_ps(planes[p][0], center_x));
+			distance = _mm_add_ps(distance, _mm_mul_ps(planes[p][1], center_y));
+			distance = _mm_add_ps(distance, _mm_mul_ps(planes[p][2], center_z));
+
+			distance = _mm_add_ps(distance, _mm_mul_ps(planes_abs[p][0], extent_x));
+			distance = _mm_add_ps(distance, _mm_mul_ps(planes_abs[p][1], extent_y));
+			distance = _mm_add_ps(distance, _mm_mul_ps(planes_abs[p][2], extent_z));
+
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(distance, _mm_setzero_ps()));
+		}
+
+		int mask = ~_mm_movemask_ps(outside) & 0xF;
+
+		while (mask != 0)
+		{
+			visible[visible_count++] = (uint32_t)(i + bit_scan_forward64(mask));
+
+			mask &= mask - 1;
+		}
+	}
+#endif
+
+	for (; i < boxes->count; i++)
+	{
+		if (frustum_box_visible(frustum, boxes, i))
+		{
+			visible[visible_count++] = (uint32_t)i;
+		}
+	}
+
+	return visible_count;
+}
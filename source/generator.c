@@ -1,143 +1,393 @@
 #include "generator.h"
 
+#include "cpu.h"
 #include "mesher.h"
-#include "queue.h"
+#include "queue_blocking.h"
+#include "utility.h"
+#include "world.h"
 
 #include "simplex.h"
 #include "tinycthread.h"
 
+#include <stdint.h>
+#include <string.h>
+
 #define GENERATOR_SEED 19940126
 #define GENERATOR_CHUNK_CAPACITY (32 * 32 * 16)
+#define GENERATOR_THREADS_MAX 64
+#define GENERATOR_COLUMNS (CHUNK_LENGTH_EX * CHUNK_LENGTH_EX)
+#define GENERATOR_OCTAVES 3
+#define GENERATOR_FEATURE_SIZE 24.0
+
+// The heightmap cache is direct mapped on the chunk column coordinates modulo
+// this length.  It must be wider than the loaded area (2 * chunk_radius) so
+// that columns in view never evict each other.
+#define GENERATOR_HEIGHTMAP_CACHE_LENGTH 64
+
+struct heightmap
+{
+	bool valid;
+	int x;
+	int z;
+
+	int16_t cutoffs[GENERATOR_COLUMNS];
+};
 
 struct generator
 {
-	bool running;
-	thrd_t thread;
-	mtx_t mutex;
+	thrd_t threads[GENERATOR_THREADS_MAX];
+	int thread_count;
 
+	// Shared by all workers.  simplex2() only reads from the context.
 	struct osn_context* noise;
-	struct queue chunks;
+	struct queue_blocking chunks;
+
+	// Heightmaps are the same for every chunk in a column, so they are
+	// computed once per column and shared.  Entries are copied in and out
+	// under the mutex, which is cheap next to evaluating the noise.
+	mtx_t mutex_heightmaps;
+	struct heightmap* heightmaps;
+	size_t heightmap_hits;
+	size_t heightmap_misses;
+
+	// Chunks generated since the threads were started, and how many of those
+	// were uniform and skipped the mesher.
+	mtx_t mutex;
+	size_t generated;
+	size_t uniform;
 };
 
 static struct generator generator = { 0 };
 
-static void thread_sleep(int nano_seconds)
+// Octave frequency relative to the feature size and its weight in the sum.
+static const double octave_frequency[GENERATOR_OCTAVES] = { 1.0 / 4.0, 1.0 / 2.0, 1.0 };
+static const double octave_weight[GENERATOR_OCTAVES] = { 4.0 / 7.0, 2.0 / 7.0, 1.0 / 7.0 };
+
+// Computes the terrain height of every column of the chunk, including the
+// one voxel apron, in world voxel units.
+static void generator_heightmap_compute(struct chunk* chunk, int16_t* cutoffs)
 {
-	struct _ttherad_timespec time_sleep = { 0 };
-	timespec_get(&time_sleep, TIME_UTC);
+	float sample_x[GENERATOR_COLUMNS];
+	float sample_z[GENERATOR_COLUMNS];
+	float noise[GENERATOR_OCTAVES][GENERATOR_COLUMNS];
 
-	time_sleep.tv_nsec += nano_seconds;
-	time_sleep.tv_sec += time_sleep.tv_nsec / 1000000000;
-	time_sleep.tv_nsec %= 1000000000;
+	double chunk_x_offset = chunk->x * CHUNK_LENGTH - 1;
+	double chunk_z_offset = chunk->z * CHUNK_LENGTH - 1;
 
-	thrd_sleep(&time_sleep, NULL);
+	double max_y = CHUNK_LENGTH * 2;
+
+	for (int octave = 0; octave < GENERATOR_OCTAVES; octave++)
+	{
+		double frequency = octave_frequency[octave] / GENERATOR_FEATURE_SIZE;
+
+		for (int z = 0; z < CHUNK_LENGTH_EX; z++)
+		{
+			for (int x = 0; x < CHUNK_LENGTH_EX; x++)
+			{
+				sample_x[z * CHUNK_LENGTH_EX + x] = (float)((chunk_x_offset + x) * frequency);
+				sample_z[z * CHUNK_LENGTH_EX + x] = (float)((chunk_z_offset + z) * frequency);
+			}
+		}
+
+		simplex2_batch(generator.noise, sample_x, sample_z, noise[octave], GENERATOR_COLUMNS);
+	}
+
+	for (int i = 0; i < GENERATOR_COLUMNS; i++)
+	{
+		double value = 0.0;
+
+		for (int octave = 0; octave < GENERATOR_OCTAVES; octave++)
+		{
+			value += noise[octave][i] * octave_weight[octave];
+		}
+
+		value = (value + 1.0) / 2.0;
+
+		cutoffs[i] = (int16_t)(value * max_y);
+	}
 }
 
-static int generator_loop(void* arg)
+static struct heightmap* generator_heightmap_slot(int x, int z)
+{
+	// Mask rather than modulo so negative coordinates wrap correctly.
+	int slot_x = x & (GENERATOR_HEIGHTMAP_CACHE_LENGTH - 1);
+	int slot_z = z & (GENERATOR_HEIGHTMAP_CACHE_LENGTH - 1);
+
+	return &generator.heightmaps[slot_z * GENERATOR_HEIGHTMAP_CACHE_LENGTH + slot_x];
+}
+
+// Fetches the chunk's column heightmap from the cache, computing and caching
+// it on a miss.  Two workers missing on the same column at once both compute
+// it, which is harmless.
+static void generator_heightmap(struct chunk* chunk, int16_t* cutoffs)
 {
-	while (true)
+	struct heightmap* heightmap = generator_heightmap_slot(chunk->x, chunk->z);
+
+	mtx_lock(&generator.mutex_heightmaps);
+
+	if (heightmap->valid == true && heightmap->x == chunk->x && heightmap->z == chunk->z)
 	{
-		mtx_lock(&generator.mutex);
+		memcpy(cutoffs, heightmap->cutoffs, sizeof(heightmap->cutoffs));
+
+		generator.heightmap_hits++;
+
+		mtx_unlock(&generator.mutex_heightmaps);
+
+		return;
+	}
+
+	generator.heightmap_misses++;
+
+	mtx_unlock(&generator.mutex_heightmaps);
+
+	generator_heightmap_compute(chunk, cutoffs);
+
+	mtx_lock(&generator.mutex_heightmaps);
+
+	heightmap->valid = true;
+	heightmap->x = chunk->x;
+	heightmap->z = chunk->z;
+	memcpy(heightmap->cutoffs, cutoffs, sizeof(heightmap->cutoffs));
+
+	mtx_unlock(&generator.mutex_heightmaps);
+}
+
+// Air and the terrain's single solid block.
+static const struct color generator_palette[] = { { 0, 0, 0, 0 }, { 255, 255, 255, 255 } };
+
+// Fills blocks, apron included, with palette indices from the column heights
+// and classifies the chunk.  Each column is solid from the bottom up to its fill
+// height, so every y slice is either all solid, all air, or a branchless
+// compare of the slice's y against the fill heights.  Writes are contiguous
+// along the slice, and every voxel is written so the chunk does not need
+// clearing first.  Uniform chunks are classified from the fill range alone
+// and blocks is left untouched.
+static enum chunk_contents generator_fill(struct chunk* chunk, const int16_t* cutoffs, unsigned char* blocks)
+{
+	unsigned char fills[GENERATOR_COLUMNS];
+
+	int chunk_y_offset = chunk->y * CHUNK_LENGTH - 1;
+
+	int fill_min = CHUNK_LENGTH_EX;
+	int fill_max = 0;
+
+	// Lowest fill of the columns inside the chunk, ignoring the apron.
+	int fill_min_interior = CHUNK_LENGTH_EX;
 
-		if (generator.running == false)
+	for (int z = 0; z < CHUNK_LENGTH_EX; z++)
+	{
+		for (int x = 0; x < CHUNK_LENGTH_EX; x++)
 		{
-			mtx_unlock(&generator.mutex);
+			int i = z * CHUNK_LENGTH_EX + x;
 
-			break;
+			// Number of solid voxels at the bottom of the column.
+			int fill = max(0, min(cutoffs[i] - chunk_y_offset + 1, CHUNK_LENGTH_EX));
+
+			fills[i] = (unsigned char)fill;
+
+			fill_min = min(fill_min, fill);
+			fill_max = max(fill_max, fill);
+
+			if (x > 0 && x <= CHUNK_LENGTH && z > 0 && z <= CHUNK_LENGTH)
+			{
+				fill_min_interior = min(fill_min_interior, fill);
+			}
 		}
+	}
 
-		struct chunk* chunk = (struct chunk*) queue_pop(&generator.chunks);
+	if (fill_max == 0)
+	{
+		return CHUNK_CONTENTS_AIR;
+	}
 
-		mtx_unlock(&generator.mutex);
+	if (fill_min == CHUNK_LENGTH_EX)
+	{
+		return CHUNK_CONTENTS_SOLID;
+	}
+
+	int slices_solid = fill_min * CHUNK_SLICE_EX;
+	int slices_air = (CHUNK_LENGTH_EX - fill_max) * CHUNK_SLICE_EX;
+
+	memset(blocks, 1, slices_solid);
+	memset(blocks + fill_max * CHUNK_SLICE_EX, 0, slices_air);
+
+	for (int y = fill_min; y < fill_max; y++)
+	{
+		unsigned char* slice = blocks + y * CHUNK_SLICE_EX;
 
-		if (chunk == NULL)
+		for (int i = 0; i < GENERATOR_COLUMNS; i++)
 		{
-			//thread_sleep(100000000);
-			continue;
+			slice[i] = (unsigned char)(y < fills[i]);
 		}
+	}
+
+	// The interior is solid up to and including its top layer, but some of
+	// the apron is air.  Only the chunk's outer shell can have faces.
+	if (fill_min_interior >= CHUNK_LENGTH + 1)
+	{
+		return CHUNK_CONTENTS_SOLID_EXPOSED;
+	}
+
+	return CHUNK_CONTENTS_MIXED;
+}
+
+static int generator_loop(void* arg)
+{
+	struct chunk* chunk = NULL;
 
+	int16_t cutoffs[GENERATOR_COLUMNS];
+
+	// Unpacked palette indices, packed into the chunk once filled.
+	unsigned char* blocks = malloc(CHUNK_VOLUME_EX);
+	check_allocation(blocks);
+
+	// Sleeps until work arrives.  Returns NULL once the queue is closed.
+	while (chunk = queue_blocking_pop(&generator.chunks), chunk)
+	{
 		// TODO: Generate chunk.
-		chunk_clear(chunk);
+		generator_heightmap(chunk, cutoffs);
 
-		double chunk_x_offset = chunk->x * CHUNK_LENGTH - 1;
-		double chunk_y_offset = chunk->y * CHUNK_LENGTH - 1;
-		double chunk_z_offset = chunk->z * CHUNK_LENGTH - 1;
+		chunk->contents = generator_fill(chunk, cutoffs, blocks);
 
-		double feature_size = 24.0;
-		double max_y = CHUNK_LENGTH * 2;
-		
-		for (int z = 0; z < CHUNK_LENGTH_EX; z++)
+		bool uniform = false;
+
+		switch (chunk->contents)
 		{
-			for (int x = 0; x < CHUNK_LENGTH_EX; x++)
-			{
-				double sample_x = (chunk_x_offset + x) / feature_size;
-				double sample_z = (chunk_z_offset + z) / feature_size;
+		case CHUNK_CONTENTS_AIR:
+			chunk_voxels_fill(chunk, generator_palette[0]);
+			uniform = true;
+			break;
 
-				double v0 = simplex2(generator.noise, sample_x / 4.0, sample_z / 4.0);
-				double v1 = simplex2(generator.noise, sample_x / 2.0, sample_z / 2.0);
-				double v2 = simplex2(generator.noise, sample_x, sample_z);
+		case CHUNK_CONTENTS_SOLID:
+			chunk_voxels_fill(chunk, generator_palette[1]);
+			uniform = true;
+			break;
 
-				double value = ((v0 * 4 / 7.0 + v1 * 2 / 7.0 + v2 * 1 / 7.0) + 1.0) / 2.0;
+		default:
+			chunk_voxels_pack(chunk, blocks, generator_palette, 2);
+			break;
+		}
 
-				int cutoff = (int)(value * max_y);
+		mtx_lock(&generator.mutex);
+		generator.generated++;
+		generator.uniform += uniform;
+		mtx_unlock(&generator.mutex);
 
-				for (int y = 0; y < CHUNK_LENGTH_EX; y++)
-				{
-					if (chunk_y_offset + y <= cutoff)
-					{
-						//chunk_set(chunk, x, y, z, true);
-						chunk->blocks[y * CHUNK_SLICE_EX + z * CHUNK_LENGTH_EX + x] = 1;
-					}
-				}
-			}
-		}
+		if (uniform == true)
+		{
+			// Nothing to see, skip the mesher.
+			chunk->mesh = NULL;
 
-		// Pass the chunk on to the mesher.
-		mesher_queue_work(chunk);
+			world_add_chunk(chunk);
+		}
+		else
+		{
+			// Pass the chunk on to the mesher.
+			mesher_queue_work(chunk);
+		}
 	}
 
+	free(blocks);
+
 	return 0;
 }
 
-bool generator_start_thread(void)
+bool generator_start_threads(int thread_count)
 {
-	generator.running = true;
+	if (thread_count <= 0)
+	{
+		// Leave half the processors to the mesher workers and one to the main
+		// thread.
+		thread_count = cpu_count() / 2 - 1;
+	}
+
+	thread_count = max(1, min(thread_count, GENERATOR_THREADS_MAX));
+
 	simplex(GENERATOR_SEED, &generator.noise);
-	queue_init(&generator.chunks, GENERATOR_CHUNK_CAPACITY);
+	queue_blocking_init(&generator.chunks, GENERATOR_CHUNK_CAPACITY);
 
 	if (mtx_init(&generator.mutex, mtx_plain) == thrd_error)
 	{
 		return false;
 	}
 
-	if (thrd_create(&generator.thread, generator_loop, NULL) == thrd_error)
+	if (mtx_init(&generator.mutex_heightmaps, mtx_plain) == thrd_error)
 	{
 		return false;
 	}
 
+	size_t heightmap_count = GENERATOR_HEIGHTMAP_CACHE_LENGTH * GENERATOR_HEIGHTMAP_CACHE_LENGTH;
+
+	generator.heightmaps = calloc(heightmap_count, sizeof(struct heightmap));
+	check_allocation(generator.heightmaps);
+
+	for (int i = 0; i < thread_count; i++)
+	{
+		if (thrd_create(&generator.threads[i], generator_loop, NULL) == thrd_error)
+		{
+			return false;
+		}
+
+		generator.thread_count++;
+	}
+
+	log_info("Started %d generator threads.", generator.thread_count);
+
 	return true;
 }
 
-void generator_stop_thread(void)
+void generator_stop_threads(void)
 {
-	mtx_lock(&generator.mutex);
-	generator.running = false;
-	mtx_unlock(&generator.mutex);
+	queue_blocking_close(&generator.chunks);
+
+	for (int i = 0; i < generator.thread_count; i++)
+	{
+		thrd_join(generator.threads[i], NULL);
+	}
+
+	generator.thread_count = 0;
+
+	queue_blocking_free(&generator.chunks);
+	mtx_destroy(&generator.mutex);
+	mtx_destroy(&generator.mutex_heightmaps);
+	free(generator.heightmaps);
+	simplex_free(generator.noise);
 }
 
 void generator_queue_work(struct chunk* chunk)
+{
+	// Blocks while the work queue is full.
+	queue_blocking_push(&generator.chunks, chunk);
+}
+
+size_t generator_chunks_generated(void)
 {
 	mtx_lock(&generator.mutex);
 
-	while (queue_push(&generator.chunks, chunk) == false)
-	{
-		// Work queue is full, sleep for 0.1ms.
-		mtx_unlock(&generator.mutex);
+	size_t generated = generator.generated;
 
-		thread_sleep(100000);
+	mtx_unlock(&generator.mutex);
 
-		mtx_lock(&generator.mutex);
-	}
+	return generated;
+}
+
+size_t generator_chunks_uniform(void)
+{
+	mtx_lock(&generator.mutex);
+
+	size_t uniform = generator.uniform;
 
 	mtx_unlock(&generator.mutex);
+
+	return uniform;
+}
+
+void generator_heightmap_stats(size_t* hits, size_t* misses)
+{
+	mtx_lock(&generator.mutex_heightmaps);
+
+	*hits = generator.heightmap_hits;
+	*misses = generator.heightmap_misses;
+
+	mtx_unlock(&generator.mutex_heightmaps);
 }
@@ -0,0 +1,270 @@
+#include "mesh_heap.h"
+
+#include "bitset.h"
+#include "utility.h"
+
+#include <string.h>
+
+// Size class of a free block of the given size.
+static void mesh_heap_mapping(size_t size, int* fl, int* sl)
+{
+	*fl = bit_scan_reverse64(size);
+	*sl = (int)(size >> (*fl - MESH_HEAP_SL_BITS)) ^ MESH_HEAP_SL_COUNT;
+}
+
+static void mesh_heap_list_insert(struct mesh_heap* heap, struct mesh_heap_block* block)
+{
+	int fl = 0;
+	int sl = 0;
+	mesh_heap_mapping(block->size, &fl, &sl);
+
+	struct mesh_heap_block* head = heap->free_lists[fl][sl];
+
+	block->free = true;
+	block->free_previous = NULL;
+	block->free_next = head;
+
+	if (head != NULL)
+	{
+		head->free_previous = block;
+	}
+
+	heap->free_lists[fl][sl] = block;
+	heap->sl_bitmaps[fl] |= 1u << sl;
+	heap->fl_bitmap |= 1ull << fl;
+	heap->free_blocks++;
+}
+
+static void mesh_heap_list_remove(struct mesh_heap* heap, struct mesh_heap_block* block)
+{
+	int fl = 0;
+	int sl = 0;
+	mesh_heap_mapping(block->size, &fl, &sl);
+
+	if (block->free_previous != NULL)
+	{
+		block->free_previous->free_next = block->free_next;
+	}
+	else
+	{
+		heap->free_lists[fl][sl] = block->free_next;
+	}
+
+	if (block->free_next != NULL)
+	{
+		block->free_next->free_previous = block->free_previous;
+	}
+
+	if (heap->free_lists[fl][sl] == NULL)
+	{
+		heap->sl_bitmaps[fl] &= ~(1u << sl);
+
+		if (heap->sl_bitmaps[fl] == 0)
+		{
+			heap->fl_bitmap &= ~(1ull << fl);
+		}
+	}
+
+	block->free = false;
+	block->free_previous = NULL;
+	block->free_next = NULL;
+	heap->free_blocks--;
+}
+
+static struct mesh_heap_block* mesh_heap_descriptor_acquire(struct mesh_heap* heap)
+{
+	struct mesh_heap_block* block = heap->unused;
+
+	if (block != NULL)
+	{
+		heap->unused = block->free_next;
+	}
+
+	return block;
+}
+
+static void mesh_heap_descriptor_release(struct mesh_heap* heap, struct mesh_heap_block* block)
+{
+	block->free_next = heap->unused;
+	heap->unused = block;
+}
+
+// Absorbs next, which must follow block in address order, into block.
+static void mesh_heap_merge(struct mesh_heap* heap, struct mesh_heap_block* block, struct mesh_heap_block* next)
+{
+	block->size += next->size;
+	block->next = next->next;
+
+	if (next->next != NULL)
+	{
+		next->next->previous = block;
+	}
+
+	mesh_heap_descriptor_release(heap, next);
+}
+
+void mesh_heap_init(struct mesh_heap* heap, size_t capacity, size_t block_capacity)
+{
+	memset(heap, 0, sizeof(struct mesh_heap));
+
+	heap->capacity = capacity / MESH_HEAP_GRANULARITY * MESH_HEAP_GRANULARITY;
+	heap->block_capacity = block_capacity;
+
+	heap->blocks = calloc(block_capacity, sizeof(struct mesh_heap_block));
+	check_allocation(heap->blocks);
+
+	for (size_t i = block_capacity; i > 0; i--)
+	{
+		mesh_heap_descriptor_release(heap, &heap->blocks[i - 1]);
+	}
+
+	if (heap->capacity == 0)
+	{
+		return;
+	}
+
+	struct mesh_heap_block* block = mesh_heap_descriptor_acquire(heap);
+
+	if (block == NULL)
+	{
+		return;
+	}
+
+	block->offset = 0;
+	block->size = heap->capacity;
+	block->previous = NULL;
+	block->next = NULL;
+
+	mesh_heap_list_insert(heap, block);
+}
+
+void mesh_heap_free(struct mesh_heap* heap)
+{
+	free(heap->blocks);
+
+	memset(heap, 0, sizeof(struct mesh_heap));
+}
+
+struct mesh_heap_block* mesh_heap_allocate(struct mesh_heap* heap, size_t size)
+{
+	if (size == 0 || size > heap->capacity)
+	{
+		return NULL;
+	}
+
+	size = (size + MESH_HEAP_GRANULARITY - 1) / MESH_HEAP_GRANULARITY * MESH_HEAP_GRANULARITY;
+
+	// Round the size up to the next size class so that any block found in
+	// it is large enough without searching the list.
+	int fl = bit_scan_reverse64(size);
+	size_t rounded = size + ((size_t)1 << (fl - MESH_HEAP_SL_BITS)) - 1;
+
+	int sl = 0;
+	mesh_heap_mapping(rounded, &fl, &sl);
+
+	if (fl >= MESH_HEAP_FL_COUNT)
+	{
+		return NULL;
+	}
+
+	uint32_t sl_map = heap->sl_bitmaps[fl] & (~0u << sl);
+
+	if (sl_map == 0)
+	{
+		uint64_t fl_map = fl + 1 < 64 ? heap->fl_bitmap & (~0ull << (fl + 1)) : 0;
+
+		if (fl_map == 0)
+		{
+			return NULL;
+		}
+
+		fl = bit_scan_forward64(fl_map);
+		sl_map = heap->sl_bitmaps[fl];
+	}
+
+	sl = bit_scan_forward64(sl_map);
+
+	struct mesh_heap_block* block = heap->free_lists[fl][sl];
+
+	mesh_heap_list_remove(heap, block);
+
+	// Split off the tail when a descriptor is available for it.  Otherwise
+	// the whole block is handed out.
+	if (block->size - size >= MESH_HEAP_GRANULARITY)
+	{
+		struct mesh_heap_block* remainder = mesh_heap_descriptor_acquire(heap);
+
+		if (remainder != NULL)
+		{
+			remainder->offset = block->offset + size;
+			remainder->size = block->size - size;
+			remainder->previous = block;
+			remainder->next = block->next;
+
+			if (block->next != NULL)
+			{
+				block->next->previous = remainder;
+			}
+
+			block->next = remainder;
+			block->size = size;
+
+			mesh_heap_list_insert(heap, remainder);
+		}
+	}
+
+	heap->used += block->size;
+	heap->allocations++;
+
+	return block;
+}
+
+void mesh_heap_release(struct mesh_heap* heap, struct mesh_heap_block* block)
+{
+	heap->used -= block->size;
+	heap->allocations--;
+
+	struct mesh_heap_block* previous = block->previous;
+	struct mesh_heap_block* next = block->next;
+
+	if (next != NULL && next->free == true)
+	{
+		mesh_heap_list_remove(heap, next);
+		mesh_heap_merge(heap, block, next);
+	}
+
+	if (previous != NULL && previous->free == true)
+	{
+		mesh_heap_list_remove(heap, previous);
+		mesh_heap_merge(heap, previous, block);
+
+		block = previous;
+	}
+
+	mesh_heap_list_insert(heap, block);
+}
+
+void mesh_heap_stats_get(struct mesh_heap* heap, struct mesh_heap_stats* stats)
+{
+	stats->capacity = heap->capacity;
+	stats->used = heap->used;
+	stats->allocations = heap->allocations;
+	stats->free = heap->capacity - heap->used;
+	stats->free_blocks = heap->free_blocks;
+	stats->free_largest = 0;
+
+	if (heap->fl_bitmap == 0)
+	{
+		return;
+	}
+
+	// The largest block is in the highest non-empty class.  Blocks within a
+	// class differ in size, so walk its list.
+	int fl = bit_scan_reverse64(heap->fl_bitmap);
+	int sl = bit_scan_reverse64(heap->sl_bitmaps[fl]);
+
+	for (struct mesh_heap_block* block = heap->free_lists[fl][sl]; block != NULL; block = block->free_next)
+	{
+		stats->free_largest = max(stats->free_largest, block->size);
+	}
+}
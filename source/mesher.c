@@ -1,685 +1,1495 @@
 #include "mesher.h"
 
+#include "bitset.h"
 #include "chunk_mesh.h"
-#include "queue.h"
+#include "cpu.h"
+#include "khash.h"
+#include "mesh_heap.h"
+#include "queue_blocking.h"
 #include "stack.h"
+#include "timer.h"
 #include "utility.h"
 #include "window.h"
 #include "world.h"
 
 #include "tinycthread.h"
 
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+
 #define MESHER_CHUNK_CAPACITY (32 * 32 * 16)
 #define MESHER_MESH_CAPACITY 16384
-#define MESHER_VBO_LENGTH (1024 * 1024 * 1024)
-#define MESHER_BUFFER_LENGTH 5000000
+#define MESHER_VBO_LENGTH (256 * 1024 * 1024)
+// Every mesh can be separated from the next by a free block.
+#define MESHER_HEAP_BLOCK_CAPACITY (MESHER_MESH_CAPACITY * 2 + 1)
+#define MESHER_BUFFER_LENGTH (CHUNK_MESH_QUADS_MAX * CHUNK_MESH_QUAD_SIZE)
+#define MESHER_REGION_LENGTH (MESHER_BUFFER_LENGTH / 6)
+#define MESHER_UPLOAD_CAPACITY 256
+#define MESHER_BATCH_LENGTH 16
+#define MESHER_THREADS_MAX 64
+#define MESHER_FENCES_MAX 8
+
+// Meshes shared between chunks, keyed by mesher_chunk_hash().
+KHASH_MAP_INIT_INT64(mesh_cache, struct chunk_mesh*)
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MESHER_SSE2
+#include <emmintrin.h>
+#endif
+
+// A list of meshes released before a fence was inserted.  Their space is
+// reclaimed once the GPU has passed the fence.
+struct mesher_fence
+{
+	GLsync sync;
+	struct chunk_mesh* meshes;
+};
+
+// Scratch state of one mesher worker.  Workers build vertex data in their own
+// buffer and hand it to the uploader, which alone writes to the VBO.
+struct mesher_worker
+{
+	thrd_t thread;
+
+	// Faces are written to one region of MESHER_REGION_LENGTH bytes per
+	// normal, quads[normal] long, and compacted before the upload.
+	GLubyte* buffer;
+	size_t quads[6];
+
+	// The chunk being meshed, unpacked to one palette index per voxel.
+	unsigned char* blocks;
+
+	// The palette blocks index into, with air at 0.
+	struct color colors[CHUNK_PALETTE_CAPACITY];
+
+	// Whether to bake ambient occlusion into the chunk being meshed.  Coarse
+	// levels of detail skip it, as occlusion varying inside a cell would stop
+	// its faces from merging.
+	bool occlusion;
+
+#if defined(VOXEL_COMPACT_VERTICES)
+	// The chunk being meshed's palette mapped into the shared palette.
+	unsigned char color_indices[CHUNK_PALETTE_CAPACITY];
+#endif
+
+	// Binary mesher occupancy.  rows[axis][v][u] holds the voxels along axis
+	// at the apron coordinates u and v on the axes after it, (axis + 1) % 3
+	// and (axis + 2) % 3.  planes[slice][v] bit u is set for a face in the
+	// slice, in interior coordinates.
+	uint64_t rows[3][CHUNK_LENGTH_EX][CHUNK_LENGTH_EX];
+	uint32_t planes[CHUNK_LENGTH][CHUNK_LENGTH];
+
+	// Connectivity flood fill rows, indexed y * CHUNK_LENGTH + z with bit x
+	// for the voxel at x.  pending holds the bits filled but not yet spread
+	// to the neighbouring rows, and queue the rows with pending bits.
+	uint32_t flood_air[CHUNK_SLICE];
+	uint32_t flood_filled[CHUNK_SLICE];
+	uint32_t flood_pending[CHUNK_SLICE];
+	uint16_t flood_queue[CHUNK_SLICE];
+};
+
+// A finished mesh waiting for the uploader.  The vertex data follows the
+// structure in the same allocation.
+struct mesher_upload
+{
+	struct chunk* chunk;
+	uint64_t hash;
+	GLubyte* data;
+	size_t length;
+	size_t quads[6];
+	struct chunk_mesh_occluder occluders[3];
+	unsigned short connectivity;
+};
+
+struct mesher
+{
+	// Copies finished meshes into the VBO.  Owns the offscreen
+	// context used to flush the mapped VBO.
+	thrd_t thread;
+
+	struct mesher_worker* workers;
+	int worker_count;
+
+	mtx_t mutex_stats;
+
+	// Guards the heap and the mesh stack, which the uploader allocates from
+	// and the main thread releases to.
+	mtx_t mutex_meshes;
+
+	// Chunks pending meshing.
+	struct queue_blocking chunks;
+
+	// Finished meshes pending upload.
+	struct queue_blocking uploads;
+
+	// A buffer for chunk_mesh structures.
+	struct chunk_mesh* mesh_buffer;
+
+	// A stack for storing and retrieving unused chunk_mesh structures.
+	struct stack mesh_stack;
+
+	// Meshes are sub-allocated from the persistently mapped VBO.  Space is
+	// reusable once a mesh is released and the GPU is done with it, in any
+	// order.
+	GLuint vbo;
+	GLubyte* vbo_data;
+	struct mesh_heap heap;
+
+	// Every uploaded mesh still held by a chunk, so chunks with the same
+	// voxels can share it.  Guarded by mutex_meshes.
+	khash_t(mesh_cache)* cache;
+	struct mesher_cache_stats cache_stats;
+
+	// Released meshes may still be read by frames queued on the GPU, so
+	// their space is held back until a fence inserted after those frames
+	// has signalled.  retired collects meshes released since the last fence
+	// and fences is a FIFO of older lists.  Main thread only.
+	struct chunk_mesh* retired;
+	struct mesher_fence fences[MESHER_FENCES_MAX];
+	size_t fence_front;
+	size_t fence_count;
+
+#if defined(VOXEL_COMPACT_VERTICES)
+	// Colors of all chunks, indexed by compact vertices and uploaded by the
+	// renderer.  Entries are never removed.  palette_version changes whenever
+	// an entry is added.
+	mtx_t mutex_palette;
+	struct color palette[CHUNK_PALETTE_CAPACITY];
+	int palette_length;
+	unsigned int palette_version;
+#endif
+
+	// Guarded by mutex_stats along with the stats.
+	enum mesher_mode mode;
+
+	struct mesher_stats stats;
+};
+
+static struct mesher mesher = { 0 };
+
+// ---------------- START MESH HEAP FUNCTIONS ---------------- //
+
+static struct chunk_mesh* mesher_heap_copy_into(void* source, size_t length)
+{
+	mtx_lock(&mesher.mutex_meshes);
+
+	struct mesh_heap_block* block = mesh_heap_allocate(&mesher.heap, length);
+
+	struct chunk_mesh* mesh = NULL;
+
+	if (block != NULL)
+	{
+		mesh = stack_pop(&mesher.mesh_stack);
+
+		if (mesh == NULL)
+		{
+			mesh_heap_release(&mesher.heap, block);
+		}
+	}
+
+	mtx_unlock(&mesher.mutex_meshes);
+
+	if (mesh == NULL)
+	{
+		return NULL;
+	}
+
+	mesh->private.block = block;
+
+	mesh->first = (GLint)(block->offset / CHUNK_MESH_VERTEX_SIZE);
+	mesh->count = (GLsizei)(length / CHUNK_MESH_VERTEX_SIZE);
+	mesh->index_count = mesh->count / 4 * 6;
+
+	memcpy(mesher.vbo_data + block->offset, source, length);
+
+#ifndef VOXEL_HEADLESS
+	glFlushMappedNamedBufferRange(mesher.vbo, block->offset, length);
+#endif
+
+	return mesh;
+}
+
+// ---------------- END MESH HEAP FUNCTIONS ---------------- //
+
+// ---------------- START MESH CACHE FUNCTIONS ---------------- //
+
+#define MESHER_HASH_PRIME_1 0x9E3779B185EBCA87ull
+#define MESHER_HASH_PRIME_2 0xC2B2AE3D27D4EB4Full
+#define MESHER_HASH_PRIME_3 0x165667B19E3779F9ull
+
+static INLINE uint64_t mesher_hash_round(uint64_t hash, uint64_t value)
+{
+	hash += value * MESHER_HASH_PRIME_2;
+	hash = (hash << 31) | (hash >> 33);
+
+	return hash * MESHER_HASH_PRIME_1;
+}
+
+// Folds length bytes into hash 8 at a time, in the manner of a single lane of
+// xxHash64.
+static uint64_t mesher_hash(uint64_t hash, const void* data, size_t length)
+{
+	const unsigned char* bytes = data;
+
+	for (; length >= 8; bytes += 8, length -= 8)
+	{
+		uint64_t value = 0;
+		memcpy(&value, bytes, 8);
+
+		hash = mesher_hash_round(hash, value);
+	}
+
+	uint64_t tail = 0;
+	memcpy(&tail, bytes, length);
+
+	return mesher_hash_round(hash, tail ^ length);
+}
+
+// Key of the mesh the chunk would produce.  Meshes are in chunk coordinates,
+// so chunks with the same packed voxels and palette mesh to the same vertices
+// at the same level of detail and mode.  Equal keys are trusted without
+// comparing the voxels; with 64 bits and a few thousand meshes a collision is
+// vanishingly unlikely.
+static uint64_t mesher_chunk_hash(const struct chunk* chunk, enum mesher_mode mode)
+{
+	const struct chunk_voxels* voxels = &chunk->voxels;
+
+	uint64_t hash = MESHER_HASH_PRIME_3;
+
+	hash = mesher_hash_round(hash, (uint64_t)chunk->lod_requested | (uint64_t)mode << 8 | (uint64_t)voxels->bits << 16);
+	hash = mesher_hash(hash, voxels->palette, voxels->palette_length * sizeof(struct color));
+	hash = mesher_hash(hash, voxels->data, voxels->data_length);
+
+	// Avalanche so the low bits khash buckets by depend on every input bit.
+	hash ^= hash >> 33;
+	hash *= MESHER_HASH_PRIME_2;
+	hash ^= hash >> 29;
+	hash *= MESHER_HASH_PRIME_3;
+	hash ^= hash >> 32;
+
+	return hash;
+}
+
+// Returns the cached mesh for hash with a reference added, or NULL.
+static struct chunk_mesh* mesher_cache_acquire(uint64_t hash)
+{
+	struct chunk_mesh* mesh = NULL;
+
+	mtx_lock(&mesher.mutex_meshes);
+
+	khint_t iter = kh_get(mesh_cache, mesher.cache, hash);
+
+	if (iter != kh_end(mesher.cache))
+	{
+		mesh = kh_value(mesher.cache, iter);
+		mesh->private.references++;
+
+		mesher.cache_stats.hits++;
+	}
+
+	mtx_unlock(&mesher.mutex_meshes);
+
+	return mesh;
+}
+
+// Adds a freshly uploaded mesh, holding one reference, to the cache.  Only
+// the uploader inserts, after missing in mesher_cache_acquire(), so the key
+// is never already present.
+static void mesher_cache_insert(struct chunk_mesh* mesh, uint64_t hash)
+{
+	mesh->private.hash = hash;
+	mesh->private.references = 1;
+
+	mtx_lock(&mesher.mutex_meshes);
+
+	int result = 0;
+	khint_t iter = kh_put(mesh_cache, mesher.cache, hash, &result);
+	kh_value(mesher.cache, iter) = mesh;
+
+	mesher.cache_stats.misses++;
+
+	mtx_unlock(&mesher.mutex_meshes);
+}
+
+// ---------------- END MESH CACHE FUNCTIONS ---------------- //
+
+// Returns a list of meshes chained through private.next to the heap.
+static void mesher_meshes_reclaim(struct chunk_mesh* meshes)
+{
+	mtx_lock(&mesher.mutex_meshes);
+
+	while (meshes != NULL)
+	{
+		struct chunk_mesh* next = meshes->private.next;
+
+		mesh_heap_release(&mesher.heap, meshes->private.block);
+
+		stack_push(&mesher.mesh_stack, meshes);
+
+		meshes = next;
+	}
+
+	mtx_unlock(&mesher.mutex_meshes);
+}
+
+void mesher_release_mesh(struct chunk* chunk)
+{
+	struct chunk_mesh* mesh = chunk->mesh;
+
+	chunk->mesh = NULL;
+
+	// Removing the last reference and the cache entry together means no
+	// worker can pick the mesh up once it is on its way to being freed.
+	mtx_lock(&mesher.mutex_meshes);
+
+	bool unused = --mesh->private.references == 0;
+
+	if (unused == true)
+	{
+		kh_del(mesh_cache, mesher.cache, kh_get(mesh_cache, mesher.cache, mesh->private.hash));
+	}
+
+	mtx_unlock(&mesher.mutex_meshes);
+
+	if (unused == false)
+	{
+		return;
+	}
+
+#ifdef VOXEL_HEADLESS
+	// Nothing reads the meshes without a GPU.
+	mesh->private.next = NULL;
+
+	mesher_meshes_reclaim(mesh);
+#else
+	mesh->private.next = mesher.retired;
+	mesher.retired = mesh;
+#endif
+}
+
+#ifndef VOXEL_HEADLESS
+
+void mesher_fence_frame(void)
+{
+	// Fences signal in the order they were inserted, so stop at the first
+	// one the GPU has not reached.  Never waits.
+	while (mesher.fence_count > 0)
+	{
+		struct mesher_fence* fence = &mesher.fences[mesher.fence_front];
+
+		GLint status = GL_UNSIGNALED;
+		glGetSynciv(fence->sync, GL_SYNC_STATUS, 1, NULL, &status);
+
+		if (status != GL_SIGNALED)
+		{
+			break;
+		}
+
+		glDeleteSync(fence->sync);
+
+		mesher_meshes_reclaim(fence->meshes);
+
+		mesher.fence_front = (mesher.fence_front + 1) % MESHER_FENCES_MAX;
+		mesher.fence_count--;
+	}
+
+	// With every fence in use the GPU is far behind.  Meshes released this
+	// frame stay in retired and go behind the next fence that fits.
+	if (mesher.retired == NULL || mesher.fence_count == MESHER_FENCES_MAX)
+	{
+		return;
+	}
+
+	struct mesher_fence* fence = &mesher.fences[(mesher.fence_front + mesher.fence_count) % MESHER_FENCES_MAX];
+
+	fence->sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	fence->meshes = mesher.retired;
+
+	mesher.retired = NULL;
+	mesher.fence_count++;
+}
+
+#endif
+
+// Corners of a unit face for each normal, in the order the naive mesher
+// emits them.  The shared quad index buffer draws corners 0 1 2 and 3 0 2.
+static const unsigned char mesher_face_corners[6][4][3] =
+{
+	{ { 0, 0, 1 }, { 0, 0, 0 }, { 1, 0, 0 }, { 1, 0, 1 } }, // -Y
+	{ { 0, 1, 0 }, { 0, 1, 1 }, { 1, 1, 1 }, { 1, 1, 0 } }, // +Y
+	{ { 0, 0, 0 }, { 0, 1, 0 }, { 1, 1, 0 }, { 1, 0, 0 } }, // -Z
+	{ { 1, 0, 1 }, { 1, 1, 1 }, { 0, 1, 1 }, { 0, 0, 1 } }, // +Z
+	{ { 0, 0, 1 }, { 0, 1, 1 }, { 0, 1, 0 }, { 0, 0, 0 } }, // -X
+	{ { 1, 0, 0 }, { 1, 1, 0 }, { 1, 1, 1 }, { 1, 0, 1 } }, // +X
+};
+
+// Axis (0 = x, 1 = y, 2 = z) each normal points along.
+static const int mesher_normal_axis[6] = { 1, 1, 2, 2, 0, 0 };
+
+// Offsets in the unpacked blocks to the neighbour each normal faces.
+static const int mesher_normal_offsets[6] = { -CHUNK_SLICE_EX, CHUNK_SLICE_EX, -CHUNK_LENGTH_EX, CHUNK_LENGTH_EX, -1, 1 };
+
+// Every corner of a face unoccluded.
+#define MESHER_AO_NONE (CHUNK_MESH_AO_NONE * 0x55)
+
+// Offsets from the cell in front of a face to the 8 cells around it in the
+// face's plane, and for each normal and combination of those cells being
+// solid, the ambient occlusion of the face's 4 corners packed 2 bits each.
+// Filled by mesher_ao_init().
+static int mesher_ao_offsets[6][8];
+static unsigned char mesher_ao_table[6][256];
+
+static void mesher_ao_init(void)
+{
+	// Distance between neighbours along each axis in the unpacked blocks.
+	const int strides[3] = { 1, CHUNK_SLICE_EX, CHUNK_LENGTH_EX };
+
+	for (int normal = 0; normal < 6; normal++)
+	{
+		int axis = mesher_normal_axis[normal];
+		int axis_u = (axis + 1) % 3;
+		int axis_v = (axis + 2) % 3;
+
+		// Ring bit of the cell at each step along u and v, -1 for the middle.
+		int ring[3][3];
+		int bit = 0;
+
+		for (int dv = -1; dv <= 1; dv++)
+		{
+			for (int du = -1; du <= 1; du++)
+			{
+				if (du == 0 && dv == 0)
+				{
+					ring[1][1] = -1;
+					continue;
+				}
+
+				ring[dv + 1][du + 1] = bit;
+				mesher_ao_offsets[normal][bit] = du * strides[axis_u] + dv * strides[axis_v];
+				bit++;
+			}
+		}
+
+		for (int mask = 0; mask < 256; mask++)
+		{
+			unsigned char ao = 0;
+
+			for (int i = 0; i < 4; i++)
+			{
+				const unsigned char* corner = mesher_face_corners[normal][i];
+
+				int du = corner[axis_u] ? 1 : -1;
+				int dv = corner[axis_v] ? 1 : -1;
+
+				int side_u = (mask >> ring[1][du + 1]) & 1;
+				int side_v = (mask >> ring[dv + 1][1]) & 1;
+				int diagonal = (mask >> ring[dv + 1][du + 1]) & 1;
+
+				// Two sides hide the corner whatever the diagonal holds.
+				int level = (side_u && side_v) ? 0 : CHUNK_MESH_AO_NONE - (side_u + side_v + diagonal);
+
+				ao |= (unsigned char)(level << (i * 2));
+			}
+
+			mesher_ao_table[normal][mask] = ao;
+		}
+	}
+}
+
+// Ambient occlusion of the 4 corners of the face of the block at index with
+// the given normal, packed 2 bits per corner.  All corners are evaluated at
+// once by looking up the solid cells around the face in mesher_ao_table.
+static INLINE unsigned char mesher_face_ao(const struct mesher_worker* worker, const unsigned char* blocks, int index, int normal)
+{
+	if (worker->occlusion == false)
+	{
+		return MESHER_AO_NONE;
+	}
+
+	const unsigned char* front = &blocks[index + mesher_normal_offsets[normal]];
+	const int* offsets = mesher_ao_offsets[normal];
+
+	unsigned int mask = 0;
+
+	for (int i = 0; i < 8; i++)
+	{
+		mask |= (unsigned int)(front[offsets[i]] != 0) << i;
+	}
+
+	return mesher_ao_table[normal][mask];
+}
+
+// Faces may only merge when they share both the palette entry and the
+// ambient occlusion of every corner.
+static INLINE unsigned int mesher_face_key(const struct mesher_worker* worker, const unsigned char* blocks, int index, int normal)
+{
+	return blocks[index] | (unsigned int)mesher_face_ao(worker, blocks, index, normal) << 8;
+}
+
+// Emits the four corners of a face of the given normal covering size voxels
+// from position, colored by the chunk's palette entry block and shaded by the
+// packed corner occlusion ao.  Faces are appended to their normal's region of
+// the worker's buffer.
+static void mesher_emit_quad(struct mesher_worker* worker, int normal, const int* position, const int* size, unsigned char block, unsigned char ao)
+{
+	// The quad is split along the diagonal from corner 0 to 2.  Starting at
+	// corner 1 instead splits it from 1 to 3, which keeps the darker pair of
+	// corners on the diagonal so occlusion is interpolated evenly.
+	int ao_0 = ao & 3;
+	int ao_1 = (ao >> 2) & 3;
+	int ao_2 = (ao >> 4) & 3;
+	int ao_3 = (ao >> 6) & 3;
+
+	int first = (ao_0 + ao_2 > ao_1 + ao_3) ? 1 : 0;
+
+#if defined(VOXEL_COMPACT_VERTICES)
+	uint32_t corners[4];
+
+	uint32_t attributes = 0;
+	attributes |= (uint32_t)normal << CHUNK_MESH_NORMAL_SHIFT;
+	attributes |= (uint32_t)worker->color_indices[block] << CHUNK_MESH_COLOR_SHIFT;
+
+	for (int i = 0; i < 4; i++)
+	{
+		int c = (first + i) & 3;
+
+		const unsigned char* corner = mesher_face_corners[normal][c];
+
+		uint32_t x = position[0] + corner[0] * size[0];
+		uint32_t y = position[1] + corner[1] * size[1];
+		uint32_t z = position[2] + corner[2] * size[2];
+		uint32_t level = (ao >> (c * 2)) & 3;
+
+		corners[i] = attributes | (x << CHUNK_MESH_X_SHIFT) | (y << CHUNK_MESH_Y_SHIFT) | (z << CHUNK_MESH_Z_SHIFT) | (level << CHUNK_MESH_AO_SHIFT);
+	}
+#else
+	struct color color = worker->colors[block];
+
+	GLubyte corners[4][8];
+
+	for (int i = 0; i < 4; i++)
+	{
+		int c = (first + i) & 3;
+
+		const unsigned char* corner = mesher_face_corners[normal][c];
+
+		corners[i][0] = (GLubyte)(position[0] + corner[0] * size[0]);
+		corners[i][1] = (GLubyte)(position[1] + corner[1] * size[1]);
+		corners[i][2] = (GLubyte)(position[2] + corner[2] * size[2]);
+		corners[i][3] = (GLubyte)(normal | ((ao >> (c * 2)) & 3) << CHUNK_MESH_AO_SHIFT);
+		corners[i][4] = color.r;
+		corners[i][5] = color.g;
+		corners[i][6] = color.b;
+		corners[i][7] = color.a;
+	}
+#endif
+
+	// Build the corners as whole vertices and store them in one go, which is
+	// much quicker than writing the bytes one by one.
+	GLubyte* region = worker->buffer + normal * MESHER_REGION_LENGTH;
+
+	memcpy(&region[worker->quads[normal] * CHUNK_MESH_QUAD_SIZE], corners, sizeof(corners));
+
+	worker->quads[normal]++;
+}
+
+// Emits a quad for every exposed voxel face.
+static void mesher_mesh_naive(struct mesher_worker* worker, struct chunk* chunk, const unsigned char* blocks)
+{
+	const int size[3] = { 1, 1, 1 };
+
+	bool shell_only = chunk->contents == CHUNK_CONTENTS_SOLID_EXPOSED;
+
+	for (int y = 0; y < CHUNK_LENGTH; y++)
+	{
+		for (int z = 0; z < CHUNK_LENGTH; z++)
+		{
+			// Rows through the middle of a solid chunk only touch the shell
+			// at their two ends.
+			bool row_interior = y > 0 && y < CHUNK_LENGTH - 1 && z > 0 && z < CHUNK_LENGTH - 1;
+			int x_step = (shell_only == true && row_interior == true) ? CHUNK_LENGTH - 1 : 1;
+
+			for (int x = 0; x < CHUNK_LENGTH; x += x_step)
+			{
+				int index = chunk_index_ex_get(x, y, z);
+
+				unsigned char block = blocks[index];
+
+				if (block == 0)
+				{
+					continue;
+				}
+
+				const int position[3] = { x, y, z };
+
+				for (int normal = 0; normal < 6; normal++)
+				{
+					if (blocks[index + mesher_normal_offsets[normal]] == 0)
+					{
+						mesher_emit_quad(worker, normal, position, size, block, mesher_face_ao(worker, blocks, index, normal));
+					}
+				}
+			}
+		}
+	}
+}
+
+// Merges coplanar faces of the same palette entry and occlusion into
+// rectangles, one slice and normal at a time, and emits a quad per rectangle.
+static void mesher_mesh_greedy(struct mesher_worker* worker, struct chunk* chunk, const unsigned char* blocks)
+{
+	// Distance between neighbours along each axis in the unpacked blocks.
+	const int strides[3] = { 1, CHUNK_SLICE_EX, CHUNK_LENGTH_EX };
+
+	// mesher_face_key() of the face at each position in the slice, 0 for
+	// none.
+	uint16_t mask[CHUNK_SLICE];
+
+	for (int normal = 0; normal < 6; normal++)
+	{
+		int axis = mesher_normal_axis[normal];
+		int axis_u = (axis + 1) % 3;
+		int axis_v = (axis + 2) % 3;
+
+		int neighbour = (normal & 1) ? strides[axis] : -strides[axis];
+
+		for (int slice = 0; slice < CHUNK_LENGTH; slice++)
+		{
+			int position[3];
+			position[axis] = slice;
+
+			int slice_index = chunk_index_ex_get(0, 0, 0) + slice * strides[axis];
+
+			for (int v = 0; v < CHUNK_LENGTH; v++)
+			{
+				int row_index = slice_index + v * strides[axis_v];
+
+				for (int u = 0; u < CHUNK_LENGTH; u++)
+				{
+					int index = row_index + u * strides[axis_u];
+
+					bool exposed = blocks[index] != 0 && blocks[index + neighbour] == 0;
+
+					mask[v * CHUNK_LENGTH + u] = exposed ? (uint16_t)mesher_face_key(worker, blocks, index, normal) : 0;
+				}
+			}
+
+			for (int v = 0; v < CHUNK_LENGTH; v++)
+			{
+				for (int u = 0; u < CHUNK_LENGTH;)
+				{
+					uint16_t key = mask[v * CHUNK_LENGTH + u];
+
+					if (key == 0)
+					{
+						u++;
+						continue;
+					}
+
+					int width = 1;
+
+					while (u + width < CHUNK_LENGTH && mask[v * CHUNK_LENGTH + u + width] == key)
+					{
+						width++;
+					}
+
+					int height = 1;
+
+					while (v + height < CHUNK_LENGTH)
+					{
+						uint16_t* row = &mask[(v + height) * CHUNK_LENGTH + u];
+
+						bool match = true;
+
+						for (int i = 0; i < width; i++)
+						{
+							if (row[i] != key)
+							{
+								match = false;
+								break;
+							}
+						}
+
+						if (match == false)
+						{
+							break;
+						}
+
+						height++;
+					}
+
+					for (int j = 0; j < height; j++)
+					{
+						memset(&mask[(v + j) * CHUNK_LENGTH + u], 0, width * sizeof(uint16_t));
+					}
+
+					int size[3];
+					size[axis] = 1;
+					size[axis_u] = width;
+					size[axis_v] = height;
+
+					position[axis_u] = u;
+					position[axis_v] = v;
+
+					mesher_emit_quad(worker, normal, position, size, (unsigned char)key, (unsigned char)(key >> 8));
+
+					u += width;
+				}
+			}
+		}
+	}
+}
+
+// Interior bits of a 34 voxel occupancy row.
+#define MESHER_ROW_INTERIOR 0x1FFFFFFFEull
+
+// Packs 34 blocks into an occupancy row, one bit per solid block.
+static uint64_t mesher_row_occupancy(const unsigned char* row)
+{
+#if defined(MESHER_SSE2)
+	__m128i zero = _mm_setzero_si128();
+
+	uint64_t air_low = (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)&row[0]), zero));
+	uint64_t air_high = (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)&row[16]), zero));
+
+	uint64_t occupancy = ~(air_low | (air_high << 16)) & 0xFFFFFFFFull;
+
+	occupancy |= (uint64_t)(row[32] != 0) << 32;
+	occupancy |= (uint64_t)(row[33] != 0) << 33;
+
+	return occupancy;
+#else
+	uint64_t occupancy = 0;
+
+	for (int x = 0; x < CHUNK_LENGTH_EX; x++)
+	{
+		occupancy |= (uint64_t)(row[x] != 0) << x;
+	}
+
+	return occupancy;
+#endif
+}
+
+// Finds exposed faces with bit operations on occupancy rows rather than
+// testing neighbours voxel by voxel.  For each axis, every row of 34 voxels
+// along it (apron included) is packed into one 64-bit word; rows along y and
+// z are built by transposing the x rows.  A solid voxel
+// with air after it is then row & ~(row >> 1), and with air before it
+// row & ~(row << 1).  The faces are scattered into one 32x32 bitmap per
+// slice and normal, and emitted one rectangle per face or, when greedy is
+// set, merged into rectangles of matching faces by scanning the bitmaps with
+// ctz.
+static void mesher_mesh_binary(struct mesher_worker* worker, struct chunk* chunk, const unsigned char* blocks, bool greedy)
+{
+	uint64_t (*rows)[CHUNK_LENGTH_EX][CHUNK_LENGTH_EX] = worker->rows;
+	uint32_t (*planes)[CHUNK_LENGTH] = worker->planes;
+
+	// Rows along x come straight from the blocks.
+	for (int y = 0; y < CHUNK_LENGTH_EX; y++)
+	{
+		for (int z = 0; z < CHUNK_LENGTH_EX; z++)
+		{
+			rows[0][z][y] = mesher_row_occupancy(&blocks[y * CHUNK_SLICE_EX + z * CHUNK_LENGTH_EX]);
+		}
+	}
+
+	// Rows along y and z are the x rows with the bit matrix transposed, which
+	// is far cheaper than scattering single bits.
+	uint64_t matrix[64] = { 0 };
+
+	for (int y = 0; y < CHUNK_LENGTH_EX; y++)
+	{
+		for (int z = 0; z < CHUNK_LENGTH_EX; z++)
+		{
+			matrix[z] = rows[0][z][y];
+		}
+
+		memset(&matrix[CHUNK_LENGTH_EX], 0, (64 - CHUNK_LENGTH_EX) * sizeof(uint64_t));
+
+		bit_transpose64(matrix);
+
+		memcpy(rows[2][y], matrix, CHUNK_LENGTH_EX * sizeof(uint64_t));
+	}
+
+	for (int z = 0; z < CHUNK_LENGTH_EX; z++)
+	{
+		memcpy(matrix, rows[0][z], CHUNK_LENGTH_EX * sizeof(uint64_t));
+		memset(&matrix[CHUNK_LENGTH_EX], 0, (64 - CHUNK_LENGTH_EX) * sizeof(uint64_t));
+
+		bit_transpose64(matrix);
+
+		for (int x = 0; x < CHUNK_LENGTH_EX; x++)
+		{
+			rows[1][x][z] = matrix[x];
+		}
+	}
+
+	// Distance between neighbours along each axis in the unpacked blocks.
+	const int strides[3] = { 1, CHUNK_SLICE_EX, CHUNK_LENGTH_EX };
+
+	for (int normal = 0; normal < 6; normal++)
+	{
+		int axis = mesher_normal_axis[normal];
+		int axis_u = (axis + 1) % 3;
+		int axis_v = (axis + 2) % 3;
+
+		memset(planes, 0, sizeof(worker->planes));
+
+		for (int v = 1; v <= CHUNK_LENGTH; v++)
+		{
+			for (int u = 1; u <= CHUNK_LENGTH; u++)
+			{
+				uint64_t row = rows[axis][v][u];
+
+				uint64_t faces = (normal & 1) ? row & ~(row >> 1) : row & ~(row << 1);
+				faces &= MESHER_ROW_INTERIOR;
+
+				while (faces != 0)
+				{
+					int slice = bit_scan_forward64(faces) - 1;
+					faces &= faces - 1;
+
+					planes[slice][v - 1] |= 1u << (u - 1);
+				}
+			}
+		}
+
+		for (int slice = 0; slice < CHUNK_LENGTH; slice++)
+		{
+			int position[3];
+			position[axis] = slice;
+
+			int slice_index = chunk_index_ex_get(0, 0, 0) + slice * strides[axis];
+
+			for (int v = 0; v < CHUNK_LENGTH; v++)
+			{
+				uint32_t* row = &planes[slice][v];
+
+				int row_index = slice_index + v * strides[axis_v];
+
+				while (*row != 0)
+				{
+					int u = bit_scan_forward64(*row);
+
+					unsigned int key = mesher_face_key(worker, blocks, row_index + u * strides[axis_u], normal);
+
+					int width = 1;
+					int height = 1;
+
+					if (greedy == true)
+					{
+						// Length of the run of set bits starting at u, cut
+						// short at the first face that differs.
+						int length = bit_scan_forward64(~(uint64_t)(*row >> u));
+
+						while (width < length && mesher_face_key(worker, blocks, row_index + (u + width) * strides[axis_u], normal) == key)
+						{
+							width++;
+						}
+					}
+
+					uint32_t run = (uint32_t)(((1ull << width) - 1) << u);
+
+					*row &= ~run;
+
+					if (greedy == true)
+					{
+						while (v + height < CHUNK_LENGTH && (planes[slice][v + height] & run) == run)
+						{
+							int next_index = row_index + height * strides[axis_v];
+
+							bool match = true;
+
+							for (int i = 0; i < width && match == true; i++)
+							{
+								match = mesher_face_key(worker, blocks, next_index + (u + i) * strides[axis_u], normal) == key;
+							}
+
+							if (match == false)
+							{
+								break;
+							}
+
+							planes[slice][v + height] &= ~run;
+							height++;
+						}
+					}
+
+					position[axis_u] = u;
+					position[axis_v] = v;
+
+					int size[3];
+					size[axis] = 1;
+					size[axis_u] = width;
+					size[axis_v] = height;
+
+					mesher_emit_quad(worker, normal, position, size, (unsigned char)key, (unsigned char)(key >> 8));
+				}
+			}
+		}
+	}
+}
+
+#if defined(VOXEL_COMPACT_VERTICES)
+
+// Finds or adds color in the shared palette.  Once the palette is full,
+// unknown colors map to the closest existing entry.
+static unsigned char mesher_palette_index(struct color color)
+{
+	int closest = 0;
+	int closest_distance = INT_MAX;
+
+	for (int i = 0; i < mesher.palette_length; i++)
+	{
+		struct color entry = mesher.palette[i];
+
+		int dr = entry.r - color.r;
+		int dg = entry.g - color.g;
+		int db = entry.b - color.b;
+		int da = entry.a - color.a;
+
+		int distance = dr * dr + dg * dg + db * db + da * da;
+
+		if (distance == 0)
+		{
+			return (unsigned char)i;
+		}
+
+		if (distance < closest_distance)
+		{
+			closest = i;
+			closest_distance = distance;
+		}
+	}
+
+	if (mesher.palette_length == CHUNK_PALETTE_CAPACITY)
+	{
+		return (unsigned char)closest;
+	}
+
+	mesher.palette[mesher.palette_length] = color;
+	mesher.palette_version++;
 
-// TODO:  If we run into an issue where a released mesh gets overwritten with
-// new data while the old data is still in use on the GPU because the GPU is a
-// lagging behind one or more frames then we should keep two lists of released
-// meshes.  Alternate which list gets filled every couple of seconds.
-// Basically, double buffer marking meshes as released to gurantee they are old
+	return (unsigned char)mesher.palette_length++;
+}
 
-struct mesher
-{
-	bool running;
-	thrd_t thread;
-	mtx_t mutex_chunks;
-	mtx_t mutex_meshes;
+#endif
 
-	// Chunks pending meshing.
-	struct queue chunks;
+// Replaces each cell of 2^lod voxels per side with a single value: solid if
+// any voxel in it is, in the color of its topmost solid voxel.  Rounding up
+// keeps coarse surfaces at or above the detailed ones, and clearing the apron
+// to air closes every coarse chunk with walls along its borders, so no gaps
+// open between neighbours meshed at different levels.
+static void mesher_downsample(unsigned char* blocks, int lod)
+{
+	int step = 1 << lod;
 
-	// A buffer for chunk_mesh structures.
-	struct chunk_mesh* mesh_buffer;
+	for (int y = 0; y < CHUNK_LENGTH; y += step)
+	{
+		for (int z = 0; z < CHUNK_LENGTH; z += step)
+		{
+			for (int x = 0; x < CHUNK_LENGTH; x += step)
+			{
+				unsigned char value = 0;
 
-	// A stack for storing and retrieving unused ringbuffer entries.
-	struct stack mesh_stack;
+				for (int j = step - 1; j >= 0 && value == 0; j--)
+				{
+					for (int k = 0; k < step && value == 0; k++)
+					{
+						const unsigned char* row = &blocks[chunk_index_ex_get(x, y + j, z + k)];
+
+						for (int i = 0; i < step && value == 0; i++)
+						{
+							value = row[i];
+						}
+					}
+				}
 
-	// Queue for keeping record of the ringbuffer entries in use.
-	struct queue mesh_queue;
+				for (int j = 0; j < step; j++)
+				{
+					for (int k = 0; k < step; k++)
+					{
+						memset(&blocks[chunk_index_ex_get(x, y + j, z + k)], value, step);
+					}
+				}
+			}
+		}
+	}
 
-	GLuint vbo;
+	memset(blocks, 0, CHUNK_SLICE_EX);
+	memset(&blocks[(CHUNK_LENGTH_EX - 1) * CHUNK_SLICE_EX], 0, CHUNK_SLICE_EX);
 
-	struct
+	for (int y = 1; y < CHUNK_LENGTH_EX - 1; y++)
 	{
-		size_t length;
-		size_t capacity;
-		GLubyte* front;
-		GLubyte* back;
-		GLubyte* head;
-		GLubyte* tail;
-	} ringbuffer;
+		unsigned char* slice = &blocks[y * CHUNK_SLICE_EX];
 
-	GLubyte* buffer;
-};
-
-static struct mesher mesher = { 0 };
+		memset(slice, 0, CHUNK_LENGTH_EX);
+		memset(&slice[(CHUNK_LENGTH_EX - 1) * CHUNK_LENGTH_EX], 0, CHUNK_LENGTH_EX);
 
-// ---------------- START RINGBUFFER FUNCTIONS ---------------- //
+		for (int z = 1; z < CHUNK_LENGTH_EX - 1; z++)
+		{
+			slice[z * CHUNK_LENGTH_EX] = 0;
+			slice[z * CHUNK_LENGTH_EX + CHUNK_LENGTH_EX - 1] = 0;
+		}
+	}
+}
 
-static size_t ringbuffer_bytes_free()
+// Finds the longest run of completely solid interior layers along each axis.
+static void mesher_occluders(const unsigned char* blocks, struct chunk_mesh_occluder* occluders)
 {
-	if (mesher.ringbuffer.head >= mesher.ringbuffer.tail)
+	// Solid voxels per layer along x, y and z.
+	int solid[3][CHUNK_LENGTH] = { 0 };
+
+	for (int y = 0; y < CHUNK_LENGTH; y++)
 	{
-		return mesher.ringbuffer.capacity - (mesher.ringbuffer.head - mesher.ringbuffer.tail);
+		for (int z = 0; z < CHUNK_LENGTH; z++)
+		{
+			const unsigned char* row = &blocks[chunk_index_ex_get(0, y, z)];
+
+			int row_solid = 0;
+
+			for (int x = 0; x < CHUNK_LENGTH; x++)
+			{
+				int voxel_solid = row[x] != 0;
+
+				solid[0][x] += voxel_solid;
+				row_solid += voxel_solid;
+			}
+
+			solid[1][y] += row_solid;
+			solid[2][z] += row_solid;
+		}
 	}
-	else
+
+	for (int axis = 0; axis < 3; axis++)
 	{
-		return mesher.ringbuffer.tail - mesher.ringbuffer.head - 1;
+		occluders[axis].begin = 0;
+		occluders[axis].end = 0;
+
+		int begin = 0;
+
+		for (int layer = 0; layer <= CHUNK_LENGTH; layer++)
+		{
+			if (layer < CHUNK_LENGTH && solid[axis][layer] == CHUNK_SLICE)
+			{
+				continue;
+			}
+
+			if (layer - begin > occluders[axis].end - occluders[axis].begin)
+			{
+				occluders[axis].begin = (unsigned char)begin;
+				occluders[axis].end = (unsigned char)layer;
+			}
+
+			begin = layer + 1;
+		}
 	}
 }
 
-static size_t ringbuffer_bytes_from_end()
+// Extends seeds, which must be open, to the whole runs of open bits holding
+// them.  Each step doubles the distance filled in both directions.
+static INLINE uint32_t mesher_row_fill(uint32_t seeds, uint32_t open)
 {
-	return mesher.ringbuffer.back - mesher.ringbuffer.head;
-}
+	uint32_t up = seeds;
+	uint32_t down = seeds;
+	uint32_t up_open = open;
+	uint32_t down_open = open;
 
-static size_t ringbuffer_bytes_used()
-{
-	return mesher.ringbuffer.capacity - ringbuffer_bytes_free();
-}
+	for (int shift = 1; shift < 32; shift *= 2)
+	{
+		up |= (up << shift) & up_open;
+		up_open &= up_open << shift;
 
-static size_t ringbuffer_offset()
-{
-	return mesher.ringbuffer.head - mesher.ringbuffer.front;
+		down |= (down >> shift) & down_open;
+		down_open &= down_open >> shift;
+	}
+
+	return up | down;
 }
 
-static struct chunk_mesh* ringbuffer_copy_into(void* source, size_t length)
+// Finds which faces of the chunk air connects, by flood filling each pocket
+// of interior air in turn and noting the faces it reaches.  The fill works on
+// rows of 32 voxels along x as bit masks, spreading along a row in one step
+// and to the four neighbouring rows from the bits newly filled in it.
+static unsigned short mesher_connectivity(struct mesher_worker* worker, const unsigned char* blocks)
 {
-	// Before we get started, check and see if the front of the mesh queue is a
-	// released mesh.  Recursively check.
+	uint32_t* air = worker->flood_air;
+	uint32_t* filled = worker->flood_filled;
+	uint32_t* pending = worker->flood_pending;
+	uint16_t* queue = worker->flood_queue;
 
-	while (true)
+	for (int y = 0; y < CHUNK_LENGTH; y++)
 	{
-		struct chunk_mesh* mesh = queue_peek(&mesher.mesh_queue);
-
-		if (mesh == NULL)
+		for (int z = 0; z < CHUNK_LENGTH; z++)
 		{
-			break;
+			uint64_t occupancy = mesher_row_occupancy(&blocks[chunk_index_ex_get(-1, y, z)]);
+
+			air[y * CHUNK_LENGTH + z] = ~(uint32_t)(occupancy >> 1);
 		}
+	}
 
-		mtx_lock(&mesher.mutex_meshes);
+	memset(filled, 0, CHUNK_SLICE * sizeof(uint32_t));
+	memset(pending, 0, CHUNK_SLICE * sizeof(uint32_t));
 
-		bool released = mesh->private.released;
+	unsigned short connectivity = 0;
 
-		mtx_unlock(&mesher.mutex_meshes);
+	for (int start = 0; start < CHUNK_SLICE && connectivity != CHUNK_MESH_CONNECTIVITY_ALL; start++)
+	{
+		uint32_t open = air[start] & ~filled[start];
 
-		if (released == true)
+		while (open != 0 && connectivity != CHUNK_MESH_CONNECTIVITY_ALL)
 		{
-			mesh = queue_pop(&mesher.mesh_queue);
+			// Rows are queued while they have pending bits, so the queue
+			// never holds more than every row once.
+			size_t front = 0;
+			size_t count = 0;
 
-			mesher.ringbuffer.tail += mesh->private.length;
+			uint32_t seeds = mesher_row_fill(open & (0u - open), open);
 
-			stack_push(&mesher.mesh_stack, mesh);
-		}
-		else
-		{
-			break;
-		}
-	}
+			filled[start] |= seeds;
+			pending[start] = seeds;
+			queue[count++] = (uint16_t)start;
 
-	// Get on with the actual copy logic.
+			// Faces reached, one bit per face in normal order.
+			int faces = 0;
 
-	size_t bytes_from_end = ringbuffer_bytes_from_end();
+			while (count > 0)
+			{
+				int row = queue[front];
 
-	if (length > bytes_from_end)
-	{
-		// We don't want to wrap the data over the end of the buffer.  We
-		// insert a dummy mesh entry to use up the space between the head and
-		// the end of the buffer.  The dummy entry is set as released.
+				front = (front + 1) % CHUNK_SLICE;
+				count--;
 
-		struct chunk_mesh* mesh = stack_pop(&mesher.mesh_stack);
+				uint32_t bits = pending[row];
+				pending[row] = 0;
 
-		if (mesh == NULL)
-		{
-			return NULL;
-		}
+				int y = row / CHUNK_LENGTH;
+				int z = row % CHUNK_LENGTH;
 
-		mesh->private.length = bytes_from_end;
-		mesh->private.offset = ringbuffer_offset();
-		mesh->private.released = true;
+				faces |= (y == 0) << 0 | (y == CHUNK_LENGTH - 1) << 1;
+				faces |= (z == 0) << 2 | (z == CHUNK_LENGTH - 1) << 3;
+				faces |= (int)(bits & 1) << 4 | (int)(bits >> (CHUNK_LENGTH - 1)) << 5;
 
-		mesh->first = mesh->private.offset / 8;
-		mesh->count = mesh->private.length / 8;
+				int neighbours[4] =
+				{
+					y > 0 ? row - CHUNK_LENGTH : -1,
+					y < CHUNK_LENGTH - 1 ? row + CHUNK_LENGTH : -1,
+					z > 0 ? row - 1 : -1,
+					z < CHUNK_LENGTH - 1 ? row + 1 : -1,
+				};
 
-		if (queue_push(&mesher.mesh_queue, mesh) == false)
-		{
-			// We failed to push the mesh onto the "in use" queue.  Push this
-			// mesh back onto the "unused" stack.
-			stack_push(&mesher.mesh_stack, mesh);
+				for (int i = 0; i < 4; i++)
+				{
+					int neighbour = neighbours[i];
 
-			return NULL;
-		}
+					if (neighbour < 0)
+					{
+						continue;
+					}
 
-		mesher.ringbuffer.head = mesher.ringbuffer.front;
-	}
+					uint32_t neighbour_open = air[neighbour] & ~filled[neighbour];
+					uint32_t reached = bits & neighbour_open;
 
-	if (length > ringbuffer_bytes_free())
-	{
-		return NULL;
+					if (reached == 0)
+					{
+						continue;
+					}
+
+					reached = mesher_row_fill(reached, neighbour_open);
+
+					filled[neighbour] |= reached;
+
+					if (pending[neighbour] == 0)
+					{
+						queue[(front + count) % CHUNK_SLICE] = (uint16_t)neighbour;
+						count++;
+					}
+
+					pending[neighbour] |= reached;
+				}
+			}
+
+			for (int a = 0; a < 6; a++)
+			{
+				for (int b = a + 1; b < 6; b++)
+				{
+					if ((faces >> a & 1) && (faces >> b & 1))
+					{
+						connectivity |= chunk_face_pair_bit(a, b);
+					}
+				}
+			}
+
+			open = air[start] & ~filled[start];
+		}
 	}
 
-	struct chunk_mesh* mesh = stack_pop(&mesher.mesh_stack);
+	return connectivity;
+}
 
-	if (mesh == NULL)
+// Hands a meshed chunk back to the world.  A remeshed chunk is still active
+// and drawing its old mesh, so the new one waits in remesh until the world
+// swaps them on the main thread.
+static void mesher_complete(struct chunk* chunk, struct chunk_mesh* mesh)
+{
+	if (chunk->remeshing == true)
 	{
-		return NULL;
+		chunk->remesh = mesh;
 	}
+	else
+	{
+		chunk->mesh = mesh;
+	}
+
+	world_add_chunk(chunk);
+}
+
+static void mesher_mesh(struct mesher_worker* worker, struct chunk* chunk)
+{
+	mtx_lock(&mesher.mutex_stats);
+	enum mesher_mode mode = mesher.mode;
+	mtx_unlock(&mesher.mutex_stats);
+
+	double time_start = timer_seconds();
 
-	mesh->private.length = length;
-	mesh->private.offset = ringbuffer_offset();
-	mesh->private.released = false;
+	uint64_t hash = mesher_chunk_hash(chunk, mode);
 
-	mesh->first = mesh->private.offset / 8;
-	mesh->count = mesh->private.length / 8;
+	struct chunk_mesh* cached = mesher_cache_acquire(hash);
 
-	if (queue_push(&mesher.mesh_queue, mesh) == false)
+	if (cached != NULL)
 	{
-		// We failed to push the mesh onto the "in use" queue.  Push this
-		// mesh back onto the "unused" stack.
-		stack_push(&mesher.mesh_stack, mesh);
+		mesher_complete(chunk, cached);
 
-		return NULL;
+		return;
 	}
 
-	memcpy(mesher.ringbuffer.head, source, length);
-	
-	glFlushMappedNamedBufferRange(mesher.vbo, mesher.ringbuffer.head - mesher.ringbuffer.front, length);
+	int palette_length = chunk_voxels_unpack(chunk, worker->blocks, worker->colors);
 
-	mesher.ringbuffer.head += length;
+	if (chunk->lod_requested > 0)
+	{
+		mesher_downsample(worker->blocks, chunk->lod_requested);
+	}
 
-	return mesh;
-}
+	worker->occlusion = chunk->lod_requested == 0;
 
-// ---------------- END RINGBUFFER FUNCTIONS ---------------- //
+#if defined(VOXEL_COMPACT_VERTICES)
+	mtx_lock(&mesher.mutex_palette);
 
-static void thread_sleep(int nano_seconds)
-{
-	struct _ttherad_timespec time_sleep = { 0 };
-	timespec_get(&time_sleep, TIME_UTC);
+	for (int i = 0; i < palette_length; i++)
+	{
+		worker->color_indices[i] = mesher_palette_index(worker->colors[i]);
+	}
 
-	time_sleep.tv_nsec += nano_seconds;
-	time_sleep.tv_sec += time_sleep.tv_nsec / 1000000000;
-	time_sleep.tv_nsec %= 1000000000;
-	
-	thrd_sleep(&time_sleep, NULL);
-}
+	mtx_unlock(&mesher.mutex_palette);
+#endif
 
-void mesher_release_mesh(struct chunk* chunk)
-{
-	mtx_lock(&mesher.mutex_meshes);
+	memset(worker->quads, 0, sizeof(worker->quads));
 
-	chunk->mesh->private.released = true;
+	switch (mode)
+	{
+	case MESHER_MODE_NAIVE:
+		mesher_mesh_naive(worker, chunk, worker->blocks);
+		break;
 
-	mtx_unlock(&mesher.mutex_meshes);
+	case MESHER_MODE_GREEDY:
+		mesher_mesh_greedy(worker, chunk, worker->blocks);
+		break;
 
-	chunk->mesh = NULL;
-}
+	case MESHER_MODE_BINARY:
+		mesher_mesh_binary(worker, chunk, worker->blocks, false);
+		break;
 
-static void mesher_mesh(struct chunk* chunk)
-{
-	static int blah = 0;
-	blah++;
+	case MESHER_MODE_BINARY_GREEDY:
+		mesher_mesh_binary(worker, chunk, worker->blocks, true);
+		break;
 
-	const unsigned char NORMAL_Y_NEG = 0;
-	const unsigned char NORMAL_Y_POS = 1;
-	const unsigned char NORMAL_Z_NEG = 2;
-	const unsigned char NORMAL_Z_POS = 3;
-	const unsigned char NORMAL_X_NEG = 4;
-	const unsigned char NORMAL_X_POS = 5;
+	default:
+		break;
+	}
 
-	size_t buffer_index = 0;
+	size_t length = 0;
 
-	for (int y = 0; y < CHUNK_LENGTH; y++)
+	for (int normal = 0; normal < 6; normal++)
 	{
-		for (int z = 0; z < CHUNK_LENGTH; z++)
-		{
-			for (int x = 0; x < CHUNK_LENGTH; x++)
-			{
-				if (chunk->blocks[chunk_index_ex_get(x, y, z)] == 0)
-				{
-					continue;
-				}
+		length += worker->quads[normal] * CHUNK_MESH_QUAD_SIZE;
+	}
+
+	struct mesher_upload* upload = NULL;
 
-				GLubyte vx = (GLubyte)x;
-				GLubyte vy = (GLubyte)y;
-				GLubyte vz = (GLubyte)z;
+	if (length > 0)
+	{
+		// Gather the regions into one allocation so the mesh is uploaded as a
+		// single range, ordered by normal, and the scratch buffer is free for
+		// the next chunk.
+		upload = malloc(sizeof(struct mesher_upload) + length);
+		check_allocation(upload);
 
-				// TODO:  Replace with chunk->colors values.
-				GLubyte vr = 255;
-				GLubyte vg = 255;
-				GLubyte vb = 255;
-				GLubyte va = 255;
+		upload->chunk = chunk;
+		upload->hash = hash;
+		upload->data = (GLubyte*)(upload + 1);
+		upload->length = 0;
 
-				// FACE: -Y
+		mesher_occluders(worker->blocks, upload->occluders);
 
-				if (chunk->blocks[chunk_index_ex_get(vx, vy - 1, vz)] <= 0)
-				{
-					mesher.buffer[buffer_index++] = vx;
-					mesher.buffer[buffer_index++] = vy;
-					mesher.buffer[buffer_index++] = vz + 1;
-					mesher.buffer[buffer_index++] = NORMAL_Y_NEG;
-					mesher.buffer[buffer_index++] = vr;
-					mesher.buffer[buffer_index++] = vg;
-					mesher.buffer[buffer_index++] = vb;
-					mesher.buffer[buffer_index++] = va;
-
-					mesher.buffer[buffer_index++] = vx;
-					mesher.buffer[buffer_index++] = vy;
-					mesher.buffer[buffer_index++] = vz;
-					mesher.buffer[buffer_index++] = NORMAL_Y_NEG;
-					mesher.buffer[buffer_index++] = vr;
-					mesher.buffer[buffer_index++] = vg;
-					mesher.buffer[buffer_index++] = vb;
-					mesher.buffer[buffer_index++] = va;
-
-					mesher.buffer[buffer_index++] = vx + 1;
-					mesher.buffer[buffer_index++] = vy;
-					mesher.buffer[buffer_index++] = vz;
-					mesher.buffer[buffer_index++] = NORMAL_Y_NEG;
-					mesher.buffer[buffer_index++] = vr;
-					mesher.buffer[buffer_index++] = vg;
-					mesher.buffer[buffer_index++] = vb;
-					mesher.buffer[buffer_index++] = va;
-
-					mesher.buffer[buffer_index++] = vx + 1;
-					mesher.buffer[buffer_index++] = vy;
-					mesher.buffer[buffer_index++] = vz + 1;
-					mesher.buffer[buffer_index++] = NORMAL_Y_NEG;
-					mesher.buffer[buffer_index++] = vr;
-					mesher.buffer[buffer_index++] = vg;
-					mesher.buffer[buffer_index++] = vb;
-					mesher.buffer[buffer_index++] = va;
-
-					mesher.buffer[buffer_index++] = vx;
-					mesher.buffer[buffer_index++] = vy;
-					mesher.buffer[buffer_index++] = vz + 1;
-					mesher.buffer[buffer_index++] = NORMAL_Y_NEG;
-					mesher.buffer[buffer_index++] = vr;
-					mesher.buffer[buffer_index++] = vg;
-					mesher.buffer[buffer_index++] = vb;
-					mesher.buffer[buffer_index++] = va;
-
-					mesher.buffer[buffer_index++] = vx + 1;
-					mesher.buffer[buffer_index++] = vy;
-					mesher.buffer[buffer_index++] = vz;
-					mesher.buffer[buffer_index++] = NORMAL_Y_NEG;
-					mesher.buffer[buffer_index++] = vr;
-					mesher.buffer[buffer_index++] = vg;
-					mesher.buffer[buffer_index++] = vb;
-					mesher.buffer[buffer_index++] = va;
-				}
+		// A chunk solid throughout has no air to connect its faces.
+		bool solid = upload->occluders[0].begin == 0 && upload->occluders[0].end == CHUNK_LENGTH;
 
-				// FACE: +Y
+		upload->connectivity = solid ? 0 : mesher_connectivity(worker, worker->blocks);
 
-				if (chunk->blocks[chunk_index_ex_get(vx, vy + 1, vz)] <= 0)
-				{
-					mesher.buffer[buffer_index++] = vx;
-					mesher.buffer[buffer_index++] = vy + 1;
-					mesher.buffer[buffer_index++] = vz;
-					mesher.buffer[buffer_index++] = NORMAL_Y_POS;
-					mesher.buffer[buffer_index++] = vr;
-					mesher.buffer[buffer_index++] = vg;
-					mesher.buffer[buffer_index++] = vb;
-					mesher.buffer[buffer_index++] = va;
-
-					mesher.buffer[buffer_index++] = vx;
-					mesher.buffer[buffer_index++] = vy + 1;
-					mesher.buffer[buffer_index++] = vz + 1;
-					mesher.buffer[buffer_index++] = NORMAL_Y_POS;
-					mesher.buffer[buffer_index++] = vr;
-					mesher.buffer[buffer_index++] = vg;
-					mesher.buffer[buffer_index++] = vb;
-					mesher.buffer[buffer_index++] = va;
-
-					mesher.buffer[buffer_index++] = vx + 1;
-					mesher.buffer[buffer_index++] = vy + 1;
-					mesher.buffer[buffer_index++] = vz + 1;
-					mesher.buffer[buffer_index++] = NORMAL_Y_POS;
-					mesher.buffer[buffer_index++] = vr;
-					mesher.buffer[buffer_index++] = vg;
-					mesher.buffer[buffer_index++] = vb;
-					mesher.buffer[buffer_index++] = va;
-
-					mesher.buffer[buffer_index++] = vx + 1;
-					mesher.buffer[buffer_index++] = vy + 1;
-					mesher.buffer[buffer_index++] = vz;
-					mesher.buffer[buffer_index++] = NORMAL_Y_POS;
-					mesher.buffer[buffer_index++] = vr;
-					mesher.buffer[buffer_index++] = vg;
-					mesher.buffer[buffer_index++] = vb;
-					mesher.buffer[buffer_index++] = va;
-
-					mesher.buffer[buffer_index++] = vx;
-					mesher.buffer[buffer_index++] = vy + 1;
-					mesher.buffer[buffer_index++] = vz;
-					mesher.buffer[buffer_index++] = NORMAL_Y_POS;
-					mesher.buffer[buffer_index++] = vr;
-					mesher.buffer[buffer_index++] = vg;
-					mesher.buffer[buffer_index++] = vb;
-					mesher.buffer[buffer_index++] = va;
-
-					mesher.buffer[buffer_index++] = vx + 1;
-					mesher.buffer[buffer_index++] = vy + 1;
-					mesher.buffer[buffer_index++] = vz + 1;
-					mesher.buffer[buffer_index++] = NORMAL_Y_POS;
-					mesher.buffer[buffer_index++] = vr;
-					mesher.buffer[buffer_index++] = vg;
-					mesher.buffer[buffer_index++] = vb;
-					mesher.buffer[buffer_index++] = va;
-				}
+		for (int normal = 0; normal < 6; normal++)
+		{
+			size_t region_length = worker->quads[normal] * CHUNK_MESH_QUAD_SIZE;
 
-				// FACE: -Z
+			memcpy(&upload->data[upload->length], &worker->buffer[normal * MESHER_REGION_LENGTH], region_length);
 
-				if (chunk->blocks[chunk_index_ex_get(vx, vy, vz - 1)] <= 0)
-				{
-					mesher.buffer[buffer_index++] = vx;
-					mesher.buffer[buffer_index++] = vy;
-					mesher.buffer[buffer_index++] = vz;
-					mesher.buffer[buffer_index++] = NORMAL_Z_NEG;
-					mesher.buffer[buffer_index++] = vr;
-					mesher.buffer[buffer_index++] = vg;
-					mesher.buffer[buffer_index++] = vb;
-					mesher.buffer[buffer_index++] = va;
-
-					mesher.buffer[buffer_index++] = vx;
-					mesher.buffer[buffer_index++] = vy + 1;
-					mesher.buffer[buffer_index++] = vz;
-					mesher.buffer[buffer_index++] = NORMAL_Z_NEG;
-					mesher.buffer[buffer_index++] = vr;
-					mesher.buffer[buffer_index++] = vg;
-					mesher.buffer[buffer_index++] = vb;
-					mesher.buffer[buffer_index++] = va;
-
-					mesher.buffer[buffer_index++] = vx + 1;
-					mesher.buffer[buffer_index++] = vy + 1;
-					mesher.buffer[buffer_index++] = vz;
-					mesher.buffer[buffer_index++] = NORMAL_Z_NEG;
-					mesher.buffer[buffer_index++] = vr;
-					mesher.buffer[buffer_index++] = vg;
-					mesher.buffer[buffer_index++] = vb;
-					mesher.buffer[buffer_index++] = va;
-
-					mesher.buffer[buffer_index++] = vx + 1;
-					mesher.buffer[buffer_index++] = vy;
-					mesher.buffer[buffer_index++] = vz;
-					mesher.buffer[buffer_index++] = NORMAL_Z_NEG;
-					mesher.buffer[buffer_index++] = vr;
-					mesher.buffer[buffer_index++] = vg;
-					mesher.buffer[buffer_index++] = vb;
-					mesher.buffer[buffer_index++] = va;
-
-					mesher.buffer[buffer_index++] = vx;
-					mesher.buffer[buffer_index++] = vy;
-					mesher.buffer[buffer_index++] = vz;
-					mesher.buffer[buffer_index++] = NORMAL_Z_NEG;
-					mesher.buffer[buffer_index++] = vr;
-					mesher.buffer[buffer_index++] = vg;
-					mesher.buffer[buffer_index++] = vb;
-					mesher.buffer[buffer_index++] = va;
-
-					mesher.buffer[buffer_index++] = vx + 1;
-					mesher.buffer[buffer_index++] = vy + 1;
-					mesher.buffer[buffer_index++] = vz;
-					mesher.buffer[buffer_index++] = NORMAL_Z_NEG;
-					mesher.buffer[buffer_index++] = vr;
-					mesher.buffer[buffer_index++] = vg;
-					mesher.buffer[buffer_index++] = vb;
-					mesher.buffer[buffer_index++] = va;
-				}
+			upload->length += region_length;
+			upload->quads[normal] = worker->quads[normal];
+		}
+	}
 
-				// FACE: +Z
+	double time_meshing = timer_seconds() - time_start;
 
-				if (chunk->blocks[chunk_index_ex_get(vx, vy, vz + 1)] <= 0)
-				{
-					mesher.buffer[buffer_index++] = vx + 1;
-					mesher.buffer[buffer_index++] = vy;
-					mesher.buffer[buffer_index++] = vz + 1;
-					mesher.buffer[buffer_index++] = NORMAL_Z_POS;
-					mesher.buffer[buffer_index++] = vr;
-					mesher.buffer[buffer_index++] = vg;
-					mesher.buffer[buffer_index++] = vb;
-					mesher.buffer[buffer_index++] = va;
-
-					mesher.buffer[buffer_index++] = vx + 1;
-					mesher.buffer[buffer_index++] = vy + 1;
-					mesher.buffer[buffer_index++] = vz + 1;
-					mesher.buffer[buffer_index++] = NORMAL_Z_POS;
-					mesher.buffer[buffer_index++] = vr;
-					mesher.buffer[buffer_index++] = vg;
-					mesher.buffer[buffer_index++] = vb;
-					mesher.buffer[buffer_index++] = va;
-
-					mesher.buffer[buffer_index++] = vx;
-					mesher.buffer[buffer_index++] = vy + 1;
-					mesher.buffer[buffer_index++] = vz + 1;
-					mesher.buffer[buffer_index++] = NORMAL_Z_POS;
-					mesher.buffer[buffer_index++] = vr;
-					mesher.buffer[buffer_index++] = vg;
-					mesher.buffer[buffer_index++] = vb;
-					mesher.buffer[buffer_index++] = va;
-
-					mesher.buffer[buffer_index++] = vx;
-					mesher.buffer[buffer_index++] = vy;
-					mesher.buffer[buffer_index++] = vz + 1;
-					mesher.buffer[buffer_index++] = NORMAL_Z_POS;
-					mesher.buffer[buffer_index++] = vr;
-					mesher.buffer[buffer_index++] = vg;
-					mesher.buffer[buffer_index++] = vb;
-					mesher.buffer[buffer_index++] = va;
-
-					mesher.buffer[buffer_index++] = vx + 1;
-					mesher.buffer[buffer_index++] = vy;
-					mesher.buffer[buffer_index++] = vz + 1;
-					mesher.buffer[buffer_index++] = NORMAL_Z_POS;
-					mesher.buffer[buffer_index++] = vr;
-					mesher.buffer[buffer_index++] = vg;
-					mesher.buffer[buffer_index++] = vb;
-					mesher.buffer[buffer_index++] = va;
-
-					mesher.buffer[buffer_index++] = vx;
-					mesher.buffer[buffer_index++] = vy + 1;
-					mesher.buffer[buffer_index++] = vz + 1;
-					mesher.buffer[buffer_index++] = NORMAL_Z_POS;
-					mesher.buffer[buffer_index++] = vr;
-					mesher.buffer[buffer_index++] = vg;
-					mesher.buffer[buffer_index++] = vb;
-					mesher.buffer[buffer_index++] = va;
-				}
+	mtx_lock(&mesher.mutex_stats);
+	mesher.stats.meshed++;
+	mesher.stats.meshed_bytes += length;
+	mesher.stats.mesh_seconds += time_meshing;
+	mtx_unlock(&mesher.mutex_stats);
+
+	if (upload == NULL)
+	{
+		// Nothing to upload, the chunk is ready.
+		mesher_complete(chunk, NULL);
+	}
+	else if (queue_blocking_push(&mesher.uploads, upload) == false)
+	{
+		free(upload);
+	}
+}
 
-				// FACE: -X
+static void mesher_upload(struct mesher_upload* upload)
+{
+	struct chunk* chunk = upload->chunk;
 
-				if (chunk->blocks[chunk_index_ex_get(vx - 1, vy, vz)] <= 0)
-				{
-					mesher.buffer[buffer_index++] = vx;
-					mesher.buffer[buffer_index++] = vy;
-					mesher.buffer[buffer_index++] = vz + 1;
-					mesher.buffer[buffer_index++] = NORMAL_X_NEG;
-					mesher.buffer[buffer_index++] = vr;
-					mesher.buffer[buffer_index++] = vg;
-					mesher.buffer[buffer_index++] = vb;
-					mesher.buffer[buffer_index++] = va;
-
-					mesher.buffer[buffer_index++] = vx;
-					mesher.buffer[buffer_index++] = vy + 1;
-					mesher.buffer[buffer_index++] = vz + 1;
-					mesher.buffer[buffer_index++] = NORMAL_X_NEG;
-					mesher.buffer[buffer_index++] = vr;
-					mesher.buffer[buffer_index++] = vg;
-					mesher.buffer[buffer_index++] = vb;
-					mesher.buffer[buffer_index++] = va;
-
-					mesher.buffer[buffer_index++] = vx;
-					mesher.buffer[buffer_index++] = vy + 1;
-					mesher.buffer[buffer_index++] = vz;
-					mesher.buffer[buffer_index++] = NORMAL_X_NEG;
-					mesher.buffer[buffer_index++] = vr;
-					mesher.buffer[buffer_index++] = vg;
-					mesher.buffer[buffer_index++] = vb;
-					mesher.buffer[buffer_index++] = va;
-
-					mesher.buffer[buffer_index++] = vx;
-					mesher.buffer[buffer_index++] = vy;
-					mesher.buffer[buffer_index++] = vz;
-					mesher.buffer[buffer_index++] = NORMAL_X_NEG;
-					mesher.buffer[buffer_index++] = vr;
-					mesher.buffer[buffer_index++] = vg;
-					mesher.buffer[buffer_index++] = vb;
-					mesher.buffer[buffer_index++] = va;
-
-					mesher.buffer[buffer_index++] = vx;
-					mesher.buffer[buffer_index++] = vy;
-					mesher.buffer[buffer_index++] = vz + 1;
-					mesher.buffer[buffer_index++] = NORMAL_X_NEG;
-					mesher.buffer[buffer_index++] = vr;
-					mesher.buffer[buffer_index++] = vg;
-					mesher.buffer[buffer_index++] = vb;
-					mesher.buffer[buffer_index++] = va;
-
-					mesher.buffer[buffer_index++] = vx;
-					mesher.buffer[buffer_index++] = vy + 1;
-					mesher.buffer[buffer_index++] = vz;
-					mesher.buffer[buffer_index++] = NORMAL_X_NEG;
-					mesher.buffer[buffer_index++] = vr;
-					mesher.buffer[buffer_index++] = vg;
-					mesher.buffer[buffer_index++] = vb;
-					mesher.buffer[buffer_index++] = va;
-				}
+	// Another worker may have meshed an identical chunk since this one
+	// missed the cache.
+	struct chunk_mesh* mesh = mesher_cache_acquire(upload->hash);
 
-				// FACE: +X
+	if (mesh != NULL)
+	{
+		free(upload);
 
-				if (chunk->blocks[chunk_index_ex_get(vx + 1, vy, vz)] <= 0)
-				{
-					mesher.buffer[buffer_index++] = vx + 1;
-					mesher.buffer[buffer_index++] = vy;
-					mesher.buffer[buffer_index++] = vz;
-					mesher.buffer[buffer_index++] = NORMAL_X_POS;
-					mesher.buffer[buffer_index++] = vr;
-					mesher.buffer[buffer_index++] = vg;
-					mesher.buffer[buffer_index++] = vb;
-					mesher.buffer[buffer_index++] = va;
-
-					mesher.buffer[buffer_index++] = vx + 1;
-					mesher.buffer[buffer_index++] = vy + 1;
-					mesher.buffer[buffer_index++] = vz;
-					mesher.buffer[buffer_index++] = NORMAL_X_POS;
-					mesher.buffer[buffer_index++] = vr;
-					mesher.buffer[buffer_index++] = vg;
-					mesher.buffer[buffer_index++] = vb;
-					mesher.buffer[buffer_index++] = va;
-
-					mesher.buffer[buffer_index++] = vx + 1;
-					mesher.buffer[buffer_index++] = vy + 1;
-					mesher.buffer[buffer_index++] = vz + 1;
-					mesher.buffer[buffer_index++] = NORMAL_X_POS;
-					mesher.buffer[buffer_index++] = vr;
-					mesher.buffer[buffer_index++] = vg;
-					mesher.buffer[buffer_index++] = vb;
-					mesher.buffer[buffer_index++] = va;
-
-					mesher.buffer[buffer_index++] = vx + 1;
-					mesher.buffer[buffer_index++] = vy;
-					mesher.buffer[buffer_index++] = vz + 1;
-					mesher.buffer[buffer_index++] = NORMAL_X_POS;
-					mesher.buffer[buffer_index++] = vr;
-					mesher.buffer[buffer_index++] = vg;
-					mesher.buffer[buffer_index++] = vb;
-					mesher.buffer[buffer_index++] = va;
-
-					mesher.buffer[buffer_index++] = vx + 1;
-					mesher.buffer[buffer_index++] = vy;
-					mesher.buffer[buffer_index++] = vz;
-					mesher.buffer[buffer_index++] = NORMAL_X_POS;
-					mesher.buffer[buffer_index++] = vr;
-					mesher.buffer[buffer_index++] = vg;
-					mesher.buffer[buffer_index++] = vb;
-					mesher.buffer[buffer_index++] = va;
-
-					mesher.buffer[buffer_index++] = vx + 1;
-					mesher.buffer[buffer_index++] = vy + 1;
-					mesher.buffer[buffer_index++] = vz + 1;
-					mesher.buffer[buffer_index++] = NORMAL_X_POS;
-					mesher.buffer[buffer_index++] = vr;
-					mesher.buffer[buffer_index++] = vg;
-					mesher.buffer[buffer_index++] = vb;
-					mesher.buffer[buffer_index++] = va;
-				}
+		mesher_complete(chunk, mesh);
 
-			} // x
-		} // z
-	} // y
+		return;
+	}
+
+	mesh = mesher_heap_copy_into(upload->data, upload->length);
 
-	if (buffer_index == 0)
+	if (mesh == NULL)
 	{
-		chunk->mesh = NULL;
+		log_warning("Meshing generated a NULL mesh.");
 	}
 	else
 	{
-		struct chunk_mesh* mesh = ringbuffer_copy_into(mesher.buffer, buffer_index);
+		mesh->release = mesher_release_mesh;
 
-		if (mesh == NULL)
-		{
-			log_warning("Meshing generated a NULL mesh.");
-		}
-		else
+		GLint first = mesh->first;
+
+		for (int normal = 0; normal < 6; normal++)
 		{
-			mesh->release = mesher_release_mesh;
+			mesh->faces[normal].first = first;
+			mesh->faces[normal].count = (GLsizei)(upload->quads[normal] * 4);
+
+			first += mesh->faces[normal].count;
 		}
 
-		chunk->mesh = mesh;
+		memcpy(mesh->occluders, upload->occluders, sizeof(mesh->occluders));
+		mesh->connectivity = upload->connectivity;
+
+		mesher_cache_insert(mesh, upload->hash);
 	}
 
-	world_add_chunk(chunk);
+	free(upload);
+
+	mesher_complete(chunk, mesh);
 }
 
-static int mesher_loop(void* arg)
+static int mesher_worker_loop(void* arg)
 {
-	window_claim_offscreen_context();
+	struct mesher_worker* worker = arg;
 
-	while (true)
-	{
-		mtx_lock(&mesher.mutex_chunks);
+	void* chunks[MESHER_BATCH_LENGTH];
+	size_t count = 0;
 
-		if (mesher.running == false)
+	// Sleeps until work arrives.  Returns 0 once the queue is closed.
+	while (count = queue_blocking_pop_batch(&mesher.chunks, chunks, MESHER_BATCH_LENGTH), count)
+	{
+		for (size_t i = 0; i < count; i++)
 		{
-			// Stop the thread.
-			mtx_unlock(&mesher.mutex_chunks);
-
-			break;
+			mesher_mesh(worker, (struct chunk*) chunks[i]);
 		}
+	}
+
+	return 0;
+}
 
-		struct chunk* chunk = (struct chunk*) queue_pop(&mesher.chunks);
+static int mesher_upload_loop(void* arg)
+{
+#ifndef VOXEL_HEADLESS
+	window_claim_offscreen_context();
+#endif
 
-		mtx_unlock(&mesher.mutex_chunks);
+	void* uploads[MESHER_BATCH_LENGTH];
+	size_t count = 0;
 
-		if (chunk == NULL)
+	// Sleeps until meshes arrive.  Returns 0 once the queue is closed.
+	while (count = queue_blocking_pop_batch(&mesher.uploads, uploads, MESHER_BATCH_LENGTH), count)
+	{
+		for (size_t i = 0; i < count; i++)
 		{
-			//thread_sleep(100000000);
-			continue;
+			mesher_upload((struct mesher_upload*) uploads[i]);
 		}
-		
-		// Mesh the chunk.
-		mesher_mesh(chunk);
 	}
 
 	return 0;
 }
 
-bool mesher_start_thread(void)
+bool mesher_start_threads(int thread_count)
 {
+	if (thread_count <= 0)
+	{
+		// Share the processors with the generator pool.
+		thread_count = cpu_count() / 2;
+	}
+
+	thread_count = max(1, min(thread_count, MESHER_THREADS_MAX));
+
 	// ---------------- Mesher Data Initialization ---------------- //
-	queue_init(&mesher.chunks, MESHER_CHUNK_CAPACITY);
+	queue_blocking_init(&mesher.chunks, MESHER_CHUNK_CAPACITY);
 
-	queue_init(&mesher.mesh_queue, MESHER_MESH_CAPACITY);
+	queue_blocking_init(&mesher.uploads, MESHER_UPLOAD_CAPACITY);
 
 	stack_init(&mesher.mesh_stack, MESHER_MESH_CAPACITY);
 
 	mesher.mesh_buffer = malloc(MESHER_MESH_CAPACITY * sizeof(struct chunk_mesh));
 	check_allocation(mesher.mesh_buffer);
 
-	mesher.buffer = malloc(MESHER_BUFFER_LENGTH * sizeof(GLubyte));
-	check_allocation(mesher.buffer);
+	mesher.cache = kh_init(mesh_cache);
+
+	mesher_ao_init();
+
+	mesher.workers = calloc(thread_count, sizeof(struct mesher_worker));
+	check_allocation(mesher.workers);
+
+	for (int i = 0; i < thread_count; i++)
+	{
+		mesher.workers[i].buffer = malloc(MESHER_BUFFER_LENGTH * sizeof(GLubyte));
+		check_allocation(mesher.workers[i].buffer);
+
+		mesher.workers[i].blocks = malloc(CHUNK_VOLUME_EX);
+		check_allocation(mesher.workers[i].blocks);
+	}
 
 	for (int i = 0; i < MESHER_MESH_CAPACITY; i++)
 	{
@@ -690,28 +1500,67 @@ bool mesher_start_thread(void)
 	}
 
 	// ---------------- Threading ---------------- //
-	mesher.running = true;
-
 	if (mtx_init(&mesher.mutex_meshes, mtx_plain) == thrd_error)
 	{
 		return false;
 	}
 
-	if (mtx_init(&mesher.mutex_chunks, mtx_plain) == thrd_error)
+	if (mtx_init(&mesher.mutex_stats, mtx_plain) == thrd_error)
+	{
+		return false;
+	}
+
+#if defined(VOXEL_COMPACT_VERTICES)
+	if (mtx_init(&mesher.mutex_palette, mtx_plain) == thrd_error)
 	{
 		return false;
 	}
+#endif
 	
-	if (thrd_create(&mesher.thread, mesher_loop, NULL) == thrd_error)
+	if (thrd_create(&mesher.thread, mesher_upload_loop, NULL) == thrd_error)
 	{
 		return false;
 	}
 
+	for (int i = 0; i < thread_count; i++)
+	{
+		if (thrd_create(&mesher.workers[i].thread, mesher_worker_loop, &mesher.workers[i]) == thrd_error)
+		{
+			return false;
+		}
+
+		mesher.worker_count++;
+	}
+
+	log_info("Started %d mesher threads.", mesher.worker_count);
+
 	return true;
 }
 
+#ifdef VOXEL_HEADLESS
+
+void mesher_setup_memory_buffer(void)
+{
+	// Stand in for the persistently mapped VBO so the CPU side of the mesher
+	// can run without an OpenGL context.
+	mesher.vbo_data = malloc(MESHER_VBO_LENGTH);
+	check_allocation(mesher.vbo_data);
+
+	mesh_heap_init(&mesher.heap, MESHER_VBO_LENGTH, MESHER_HEAP_BLOCK_CAPACITY);
+}
+
+#else
+
 void mesher_setup_opengl_buffer(void)
 {
+	// The terrain shaders read vertices from the VBO as a shader storage
+	// buffer, which may be smaller than MESHER_VBO_LENGTH.  The minimum
+	// guaranteed is 128 MB.
+	GLint64 length_max = 0;
+	glGetInteger64v(GL_MAX_SHADER_STORAGE_BLOCK_SIZE, &length_max);
+
+	GLsizeiptr length = (GLsizeiptr)min((GLint64)MESHER_VBO_LENGTH, length_max);
+
 	glGenBuffers(1, &mesher.vbo);
 	glBindBuffer(GL_ARRAY_BUFFER, mesher.vbo);
 
@@ -724,50 +1573,107 @@ void mesher_setup_opengl_buffer(void)
 	//flags |= GL_MAP_FLUSH_EXPLICIT_BIT;
 	//flags |= GL_MAP_UNSYNCHRONIZED_BIT;
 
-	glBufferStorage(GL_ARRAY_BUFFER, MESHER_VBO_LENGTH, NULL, flags);
+	glBufferStorage(GL_ARRAY_BUFFER, length, NULL, flags);
 
 	flags |= GL_MAP_FLUSH_EXPLICIT_BIT;
 	flags |= GL_MAP_UNSYNCHRONIZED_BIT;
 
-	mesher.ringbuffer.front = glMapBufferRange(GL_ARRAY_BUFFER, 0, MESHER_VBO_LENGTH, flags);
-
-	glVertexAttribIPointer(0, 4, GL_UNSIGNED_BYTE, 8, 0);
-	glEnableVertexAttribArray(0);
-
-	glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, 8, (GLvoid*)4);
-	glEnableVertexAttribArray(1);
+	mesher.vbo_data = glMapBufferRange(GL_ARRAY_BUFFER, 0, length, flags);
 
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-	mesher.ringbuffer.back = mesher.ringbuffer.front + MESHER_VBO_LENGTH;
-	mesher.ringbuffer.head = mesher.ringbuffer.front;
-	mesher.ringbuffer.tail = mesher.ringbuffer.front;
-	mesher.ringbuffer.length = MESHER_VBO_LENGTH;
-	mesher.ringbuffer.capacity = MESHER_VBO_LENGTH - 1;
+	mesh_heap_init(&mesher.heap, length, MESHER_HEAP_BLOCK_CAPACITY);
 }
 
-void mesher_stop_thread(void)
+GLuint mesher_vbo_get(void)
 {
-	mtx_lock(&mesher.mutex_chunks);
+	return mesher.vbo;
+}
+
+#endif
+
+void mesher_stop_threads(void)
+{
+	queue_blocking_close(&mesher.chunks);
+
+	for (int i = 0; i < mesher.worker_count; i++)
+	{
+		thrd_join(mesher.workers[i].thread, NULL);
+	}
+
+	// Every worker has finished, so nothing is pushed after the close.
+	queue_blocking_close(&mesher.uploads);
 
-	mesher.running = false;
+	thrd_join(mesher.thread, NULL);
 
-	mtx_unlock(&mesher.mutex_chunks);
+	for (int i = 0; i < mesher.worker_count; i++)
+	{
+		free(mesher.workers[i].buffer);
+		free(mesher.workers[i].blocks);
+	}
+
+	free(mesher.workers);
+	mesher.workers = NULL;
+	mesher.worker_count = 0;
 }
 
 void mesher_queue_work(struct chunk* chunk)
 {
-	mtx_lock(&mesher.mutex_chunks);
+	// Blocks while the work queue is full.
+	queue_blocking_push(&mesher.chunks, chunk);
+}
+
+void mesher_stats_get(struct mesher_stats* stats)
+{
+	mtx_lock(&mesher.mutex_stats);
 
-	while (queue_push(&mesher.chunks, chunk) == false)
-	{
-		// Work queue is full, sleep for 0.1ms.
-		mtx_unlock(&mesher.mutex_chunks);
+	*stats = mesher.stats;
 
-		thread_sleep(100000);
+	mtx_unlock(&mesher.mutex_stats);
 
-		mtx_lock(&mesher.mutex_chunks);
-	}
+	mtx_lock(&mesher.mutex_meshes);
+
+	mesh_heap_stats_get(&mesher.heap, &stats->heap);
+
+	stats->cache = mesher.cache_stats;
+	stats->cache.meshes = kh_size(mesher.cache);
+
+	mtx_unlock(&mesher.mutex_meshes);
+}
+
+void mesher_mode_set(enum mesher_mode mode)
+{
+	mtx_lock(&mesher.mutex_stats);
 
-	mtx_unlock(&mesher.mutex_chunks);
+	mesher.mode = mode;
+
+	mtx_unlock(&mesher.mutex_stats);
+}
+
+enum mesher_mode mesher_mode_get(void)
+{
+	mtx_lock(&mesher.mutex_stats);
+
+	enum mesher_mode mode = mesher.mode;
+
+	mtx_unlock(&mesher.mutex_stats);
+
+	return mode;
+}
+
+#if defined(VOXEL_COMPACT_VERTICES)
+
+unsigned int mesher_palette_get(struct color* colors)
+{
+	mtx_lock(&mesher.mutex_palette);
+
+	memcpy(colors, mesher.palette, sizeof(mesher.palette));
+
+	unsigned int version = mesher.palette_version;
+
+	mtx_unlock(&mesher.mutex_palette);
+
+	return version;
 }
+
+#endif
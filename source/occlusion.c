@@ -0,0 +1,412 @@
+#include "occlusion.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Points nearer the eye than this are not projected.
+#define OCCLUSION_W_MIN 0.1f
+
+// Boxes are tested at the finest level they span fewer texels than this of
+// on both axes.
+#define OCCLUSION_TEST_SPAN 8
+
+// Boxes are allowed to be this much further than an occluder in 1 / w before
+// they are hidden, so a box does not hide itself behind its own occluder.
+#define OCCLUSION_DEPTH_BIAS 0.001f
+
+// A projected point.  x and y are in texels and z is 1 / w.
+struct occlusion_vertex
+{
+	float x;
+	float y;
+	float z;
+};
+
+static int occlusion_level_width(int level)
+{
+	return max(1, OCCLUSION_WIDTH >> level);
+}
+
+static int occlusion_level_height(int level)
+{
+	return max(1, OCCLUSION_HEIGHT >> level);
+}
+
+static size_t occlusion_level_offset(int level)
+{
+	size_t offset = 0;
+
+	for (int i = 0; i < level; i++)
+	{
+		offset += (size_t)occlusion_level_width(i) * occlusion_level_height(i);
+	}
+
+	return offset;
+}
+
+// Projects the corners of a box, indexed by bit 0 for the maximum on x, bit 1
+// on y and bit 2 on z.  Returns false if any of them is too near the eye or
+// behind it.
+static bool occlusion_project_box(const struct occlusion_buffer* buffer, struct aabb box, struct occlusion_vertex* corners)
+{
+	for (int i = 0; i < 8; i++)
+	{
+		GLKVector4 point = GLKVector4Make(box.minmax[i & 1].x, box.minmax[(i >> 1) & 1].y, box.minmax[(i >> 2) & 1].z, 1.0f);
+		GLKVector4 clip = GLKMatrix4MultiplyVector4(buffer->matrix_vp, point);
+
+		if (clip.w < OCCLUSION_W_MIN)
+		{
+			return false;
+		}
+
+		float w_inverse = 1.0f / clip.w;
+
+		corners[i].x = (clip.x * w_inverse * 0.5f + 0.5f) * OCCLUSION_WIDTH;
+		corners[i].y = (clip.y * w_inverse * 0.5f + 0.5f) * OCCLUSION_HEIGHT;
+		corners[i].z = w_inverse;
+	}
+
+	return true;
+}
+
+// Positive when b is to the left of a going out from origin.
+static float occlusion_cross(struct occlusion_vertex origin, struct occlusion_vertex a, struct occlusion_vertex b)
+{
+	return (a.x - origin.x) * (b.y - origin.y) - (a.y - origin.y) * (b.x - origin.x);
+}
+
+// Writes the corners of the convex hull of the points to hull in counter
+// clockwise order and returns how many there are.  The points are sorted on
+// the way.  hull must have room for twice as many points.
+static int occlusion_hull(struct occlusion_vertex* points, int count, struct occlusion_vertex* hull)
+{
+	for (int i = 1; i < count; i++)
+	{
+		struct occlusion_vertex point = points[i];
+		int j = i;
+
+		while (j > 0 && (points[j - 1].x > point.x || (points[j - 1].x == point.x && points[j - 1].y > point.y)))
+		{
+			points[j] = points[j - 1];
+			j--;
+		}
+
+		points[j] = point;
+	}
+
+	// The lower half from left to right, then the upper half back.
+	int length = 0;
+
+	for (int i = 0; i < count; i++)
+	{
+		while (length >= 2 && occlusion_cross(hull[length - 2], hull[length - 1], points[i]) <= 0.0f)
+		{
+			length--;
+		}
+
+		hull[length++] = points[i];
+	}
+
+	for (int i = count - 2, lower = length + 1; i >= 0; i--)
+	{
+		while (length >= lower && occlusion_cross(hull[length - 2], hull[length - 1], points[i]) <= 0.0f)
+		{
+			length--;
+		}
+
+		hull[length++] = points[i];
+	}
+
+	return length - 1;
+}
+
+// A function that is linear in screen space, given at the center of the
+// first texel drawn and by how much it changes per texel on each axis.
+struct occlusion_plane
+{
+	float value;
+	float dx;
+	float dy;
+};
+
+// Fills the texels the convex polygon covers completely, keeping the nearest
+// depth.  A texel's depth is the least of the planes over it, taken at its
+// furthest corner, so it never claims to hide more than the polygon does.
+// Texels on the polygon's edges are left alone, as only part of them is
+// covered.
+static void occlusion_rasterize_polygon(struct occlusion_buffer* buffer, const struct occlusion_vertex* polygon, int polygon_length, struct occlusion_vertex (*planes)[3], int planes_length)
+{
+	float x_min = polygon[0].x;
+	float x_max = polygon[0].x;
+	float y_min = polygon[0].y;
+	float y_max = polygon[0].y;
+
+	for (int i = 1; i < polygon_length; i++)
+	{
+		x_min = min(x_min, polygon[i].x);
+		x_max = max(x_max, polygon[i].x);
+		y_min = min(y_min, polygon[i].y);
+		y_max = max(y_max, polygon[i].y);
+	}
+
+	int x_begin = max(0, (int)floorf(x_min));
+	int x_end = min(OCCLUSION_WIDTH, (int)ceilf(x_max));
+	int y_begin = max(0, (int)floorf(y_min));
+	int y_end = min(OCCLUSION_HEIGHT, (int)ceilf(y_max));
+
+	if (x_begin >= x_end || y_begin >= y_end)
+	{
+		return;
+	}
+
+	float x = x_begin + 0.5f;
+	float y = y_begin + 0.5f;
+
+	// Edge functions, positive inside, moved from the texel's center to its
+	// corner furthest outside the edge.
+	struct occlusion_plane edges[8];
+
+	for (int i = 0; i < polygon_length; i++)
+	{
+		struct occlusion_vertex a = polygon[i];
+		struct occlusion_vertex b = polygon[(i + 1) % polygon_length];
+
+		edges[i].dx = a.y - b.y;
+		edges[i].dy = b.x - a.x;
+		edges[i].value = (b.x - a.x) * (y - a.y) - (b.y - a.y) * (x - a.x) - (fabsf(edges[i].dx) + fabsf(edges[i].dy)) * 0.5f;
+	}
+
+	// Depth over each plane, given by three of its points, moved to the
+	// texel's corner furthest from the eye.
+	struct occlusion_plane depths[3];
+	struct occlusion_vertex center = { x, y, 0.0f };
+
+	for (int i = 0; i < planes_length; i++)
+	{
+		struct occlusion_vertex a = planes[i][0];
+		struct occlusion_vertex b = planes[i][1];
+		struct occlusion_vertex c = planes[i][2];
+
+		float area = occlusion_cross(a, b, c);
+
+		float weight_a = occlusion_cross(b, c, center) / area;
+		float weight_b = occlusion_cross(c, a, center) / area;
+		float weight_c = occlusion_cross(a, b, center) / area;
+
+		depths[i].dx = ((b.y - c.y) * a.z + (c.y - a.y) * b.z + (a.y - b.y) * c.z) / area;
+		depths[i].dy = ((c.x - b.x) * a.z + (a.x - c.x) * b.z + (b.x - a.x) * c.z) / area;
+		depths[i].value = weight_a * a.z + weight_b * b.z + weight_c * c.z - (fabsf(depths[i].dx) + fabsf(depths[i].dy)) * 0.5f;
+	}
+
+	for (int texel_y = y_begin; texel_y < y_end; texel_y++)
+	{
+		float* row = &buffer->depth[texel_y * OCCLUSION_WIDTH];
+
+		float row_edges[8];
+		float row_depths[3];
+
+		for (int i = 0; i < polygon_length; i++)
+		{
+			row_edges[i] = edges[i].value;
+			edges[i].value += edges[i].dy;
+		}
+
+		for (int i = 0; i < planes_length; i++)
+		{
+			row_depths[i] = depths[i].value;
+			depths[i].value += depths[i].dy;
+		}
+
+		for (int texel_x = x_begin; texel_x < x_end; texel_x++)
+		{
+			bool inside = true;
+
+			for (int i = 0; i < polygon_length; i++)
+			{
+				inside &= row_edges[i] >= 0.0f;
+				row_edges[i] += edges[i].dx;
+			}
+
+			float depth = row_depths[0];
+
+			for (int i = 0; i < planes_length; i++)
+			{
+				depth = min(depth, row_depths[i]);
+				row_depths[i] += depths[i].dx;
+			}
+
+			if (inside && depth > row[texel_x])
+			{
+				row[texel_x] = depth;
+			}
+		}
+	}
+}
+
+void occlusion_begin(struct occlusion_buffer* buffer, GLKMatrix4 matrix_vp, GLKVector3 eye)
+{
+	buffer->matrix_vp = matrix_vp;
+	buffer->eye = eye;
+
+	memset(buffer->depth, 0, OCCLUSION_WIDTH * OCCLUSION_HEIGHT * sizeof(float));
+}
+
+void occlusion_rasterize_box(struct occlusion_buffer* buffer, struct aabb box)
+{
+	struct occlusion_vertex corners[8];
+
+	if (occlusion_project_box(buffer, box, corners) == false)
+	{
+		return;
+	}
+
+	// A face can be seen from the eye when the eye is beyond the box on the
+	// face's axis, on the face's side.  The box's nearest surface along any
+	// ray through it is the furthest of those faces' planes, and together
+	// they cover the hull of its corners.
+	struct occlusion_vertex planes[3][3];
+	int planes_length = 0;
+
+	for (int axis = 0; axis < 3; axis++)
+	{
+		int side = 0;
+
+		if (buffer->eye.v[axis] < box.min.v[axis])
+		{
+			side = 0;
+		}
+		else if (buffer->eye.v[axis] > box.max.v[axis])
+		{
+			side = 1;
+		}
+		else
+		{
+			continue;
+		}
+
+		int u = 1 << ((axis + 1) % 3);
+		int v = 1 << ((axis + 2) % 3);
+		int base = side << axis;
+
+		planes[planes_length][0] = corners[base];
+		planes[planes_length][1] = corners[base | u];
+		planes[planes_length][2] = corners[base | v];
+
+		// Faces seen edge on cover nothing.
+		if (occlusion_cross(corners[base], corners[base | u], corners[base | v]) != 0.0f)
+		{
+			planes_length++;
+		}
+	}
+
+	if (planes_length == 0)
+	{
+		return;
+	}
+
+	struct occlusion_vertex hull[16];
+	int hull_length = occlusion_hull(corners, 8, hull);
+
+	if (hull_length < 3)
+	{
+		return;
+	}
+
+	occlusion_rasterize_polygon(buffer, hull, hull_length, planes, planes_length);
+}
+
+void occlusion_build_pyramid(struct occlusion_buffer* buffer)
+{
+	const float* source = buffer->depth;
+
+	for (int level = 1; level < OCCLUSION_LEVELS; level++)
+	{
+		int source_width = occlusion_level_width(level - 1);
+		int source_height = occlusion_level_height(level - 1);
+
+		int width = occlusion_level_width(level);
+		int height = occlusion_level_height(level);
+
+		float* destination = &buffer->depth[occlusion_level_offset(level)];
+
+		for (int y = 0; y < height; y++)
+		{
+			const float* row_0 = &source[y * 2 * source_width];
+			const float* row_1 = &source[min(y * 2 + 1, source_height - 1) * source_width];
+
+			for (int x = 0; x < width; x++)
+			{
+				int x_1 = min(x * 2 + 1, source_width - 1);
+
+				destination[y * width + x] = min(min(row_0[x * 2], row_0[x_1]), min(row_1[x * 2], row_1[x_1]));
+			}
+		}
+
+		source = destination;
+	}
+}
+
+bool occlusion_test_box(const struct occlusion_buffer* buffer, struct aabb box)
+{
+	struct occlusion_vertex corners[8];
+
+	if (occlusion_project_box(buffer, box, corners) == false)
+	{
+		return true;
+	}
+
+	float x_min = corners[0].x;
+	float x_max = corners[0].x;
+	float y_min = corners[0].y;
+	float y_max = corners[0].y;
+	float z_max = corners[0].z;
+
+	for (int i = 1; i < 8; i++)
+	{
+		x_min = min(x_min, corners[i].x);
+		x_max = max(x_max, corners[i].x);
+		y_min = min(y_min, corners[i].y);
+		y_max = max(y_max, corners[i].y);
+		z_max = max(z_max, corners[i].z);
+	}
+
+	// The texels the box's screen rectangle touches, inclusive.  Boxes off
+	// the screen are left to the frustum.
+	int x_begin = max(0, (int)floorf(x_min));
+	int x_end = min(OCCLUSION_WIDTH - 1, (int)floorf(x_max));
+	int y_begin = max(0, (int)floorf(y_min));
+	int y_end = min(OCCLUSION_HEIGHT - 1, (int)floorf(y_max));
+
+	if (x_begin > x_end || y_begin > y_end)
+	{
+		return true;
+	}
+
+	int level = 0;
+
+	while (level < OCCLUSION_LEVELS - 1 &&
+		((x_end >> level) - (x_begin >> level) >= OCCLUSION_TEST_SPAN || (y_end >> level) - (y_begin >> level) >= OCCLUSION_TEST_SPAN))
+	{
+		level++;
+	}
+
+	const float* depth = &buffer->depth[occlusion_level_offset(level)];
+	int width = occlusion_level_width(level);
+
+	// The box's nearest point against the furthest occluder in each texel.
+	float z_near = z_max * (1.0f + OCCLUSION_DEPTH_BIAS);
+
+	for (int y = y_begin >> level; y <= y_end >> level; y++)
+	{
+		for (int x = x_begin >> level; x <= x_end >> level; x++)
+		{
+			if (z_near >= depth[y * width + x])
+			{
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
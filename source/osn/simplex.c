@@ -22,6 +22,11 @@
 #include "simplex.h"
 #include "inline.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SIMPLEX_SSE2
+#include <emmintrin.h>
+#endif
+
 #define STRETCH_CONSTANT_2D (-0.211324865405187)    // (1 / sqrt(2 + 1) - 1 ) / 2;
 #define SQUISH_CONSTANT_2D  (0.366025403784439)     // (sqrt(2 + 1) -1) / 2;
 #define STRETCH_CONSTANT_3D (-1.0 / 6.0)            // (1 / sqrt(3 + 1) - 1) / 3;
@@ -342,6 +347,159 @@ double simplex2(struct osn_context *ctx, double x, double y)
 	return value / NORM_CONSTANT_2D;
 }
 
+/*
+* Batched 2D OpenSimplex Noise.
+*
+* Evaluates simplex2() at count points in single precision.  With SSE2 four
+* points are evaluated per iteration.  The region selection of simplex2() is
+* done with lane masks: the extra vertex is always at lattice offset (ox, oy)
+* from the rhombus origin, with displacement (dx0 - ox - (ox + oy) * SQUISH,
+* dy0 - oy - (ox + oy) * SQUISH), so only (ox, oy) needs to be selected.
+* Results match simplex2() to within float precision.
+*/
+#if defined(SIMPLEX_SSE2)
+
+static INLINE __m128 select_sse2(__m128 mask, __m128 a, __m128 b)
+{
+	return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+static INLINE __m128i floor_sse2(__m128 x)
+{
+	__m128i xi = _mm_cvttps_epi32(x);
+	__m128 rounded = _mm_cvtepi32_ps(xi);
+	//Truncation rounded negative values up, the all-ones mask subtracts one.
+	return _mm_add_epi32(xi, _mm_castps_si128(_mm_cmpgt_ps(rounded, x)));
+}
+
+static INLINE __m128 extrapolate2_sse2(struct osn_context *ctx, __m128i xsb, __m128i ysb, __m128 dx, __m128 dy)
+{
+	int16_t *perm = ctx->perm;
+	int32_t xsv[4], ysv[4];
+	float gx[4], gy[4];
+	int lane;
+
+	_mm_storeu_si128((__m128i *)xsv, xsb);
+	_mm_storeu_si128((__m128i *)ysv, ysb);
+
+	//There is no gather in SSE2, look the gradients up one lane at a time.
+	for (lane = 0; lane < 4; lane++) {
+		int index = perm[(perm[xsv[lane] & 0xFF] + ysv[lane]) & 0xFF] & 0x0E;
+		gx[lane] = gradients2D[index];
+		gy[lane] = gradients2D[index + 1];
+	}
+
+	return _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(gx), dx), _mm_mul_ps(_mm_loadu_ps(gy), dy));
+}
+
+static INLINE __m128 contribute2_sse2(struct osn_context *ctx, __m128i xsb, __m128i ysb, __m128 dx, __m128 dy)
+{
+	__m128 attn = _mm_sub_ps(_mm_set1_ps(2.0f), _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)));
+	//Clamping to zero removes the contribution of vertices out of range.
+	attn = _mm_max_ps(attn, _mm_setzero_ps());
+	attn = _mm_mul_ps(attn, attn);
+	return _mm_mul_ps(_mm_mul_ps(attn, attn), extrapolate2_sse2(ctx, xsb, ysb, dx, dy));
+}
+
+static __m128 simplex2_sse2(struct osn_context *ctx, __m128 x, __m128 y)
+{
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 two = _mm_set1_ps(2.0f);
+	const __m128 squish = _mm_set1_ps((float)SQUISH_CONSTANT_2D);
+	const __m128i one_i = _mm_set1_epi32(1);
+
+	//Place input coordinates onto grid.
+	__m128 stretchOffset = _mm_mul_ps(_mm_add_ps(x, y), _mm_set1_ps((float)STRETCH_CONSTANT_2D));
+	__m128 xs = _mm_add_ps(x, stretchOffset);
+	__m128 ys = _mm_add_ps(y, stretchOffset);
+
+	//Floor to get grid coordinates of rhombus (stretched square) super-cell origin.
+	__m128i xsb = floor_sse2(xs);
+	__m128i ysb = floor_sse2(ys);
+	__m128 xsbf = _mm_cvtepi32_ps(xsb);
+	__m128 ysbf = _mm_cvtepi32_ps(ysb);
+
+	//Skew out to get actual coordinates of rhombus origin.
+	__m128 squishOffset = _mm_mul_ps(_mm_add_ps(xsbf, ysbf), squish);
+
+	//Compute grid coordinates relative to rhombus origin.
+	__m128 xins = _mm_sub_ps(xs, xsbf);
+	__m128 yins = _mm_sub_ps(ys, ysbf);
+	__m128 inSum = _mm_add_ps(xins, yins);
+
+	//Positions relative to origin point.
+	__m128 dx0 = _mm_sub_ps(x, _mm_add_ps(xsbf, squishOffset));
+	__m128 dy0 = _mm_sub_ps(y, _mm_add_ps(ysbf, squishOffset));
+
+	//Contribution (1,0) and (0,1).
+	__m128 value = contribute2_sse2(ctx, _mm_add_epi32(xsb, one_i), ysb,
+		_mm_sub_ps(dx0, _mm_add_ps(one, squish)), _mm_sub_ps(dy0, squish));
+	value = _mm_add_ps(value, contribute2_sse2(ctx, xsb, _mm_add_epi32(ysb, one_i),
+		_mm_sub_ps(dx0, squish), _mm_sub_ps(dy0, _mm_add_ps(one, squish))));
+
+	//Pick the extra vertex for both triangles, then select per lane.
+	__m128 lower = _mm_cmple_ps(inSum, one);
+	__m128 xGreater = _mm_cmpgt_ps(xins, yins);
+
+	__m128 zinsLower = _mm_sub_ps(one, inSum);
+	__m128 nearLower = _mm_or_ps(_mm_cmpgt_ps(zinsLower, xins), _mm_cmpgt_ps(zinsLower, yins));
+	__m128 zinsUpper = _mm_sub_ps(two, inSum);
+	__m128 nearUpper = _mm_or_ps(_mm_cmplt_ps(zinsUpper, xins), _mm_cmplt_ps(zinsUpper, yins));
+
+	__m128 oxLower = select_sse2(nearLower, select_sse2(xGreater, one, _mm_set1_ps(-1.0f)), one);
+	__m128 oyLower = select_sse2(nearLower, select_sse2(xGreater, _mm_set1_ps(-1.0f), one), one);
+	__m128 oxUpper = select_sse2(nearUpper, select_sse2(xGreater, two, zero), zero);
+	__m128 oyUpper = select_sse2(nearUpper, select_sse2(xGreater, zero, two), zero);
+
+	__m128 ox = select_sse2(lower, oxLower, oxUpper);
+	__m128 oy = select_sse2(lower, oyLower, oyUpper);
+	__m128 extSquish = _mm_mul_ps(_mm_add_ps(ox, oy), squish);
+
+	__m128 dx_ext = _mm_sub_ps(_mm_sub_ps(dx0, ox), extSquish);
+	__m128 dy_ext = _mm_sub_ps(_mm_sub_ps(dy0, oy), extSquish);
+	__m128i xsv_ext = _mm_add_epi32(xsb, _mm_cvtps_epi32(ox));
+	__m128i ysv_ext = _mm_add_epi32(ysb, _mm_cvtps_epi32(oy));
+
+	//Contribution (0,0) or (1,1).
+	__m128 base = _mm_andnot_ps(lower, one);
+	__m128 baseOffset = _mm_add_ps(base, _mm_mul_ps(_mm_add_ps(base, base), squish));
+	__m128i base_i = _mm_cvtps_epi32(base);
+	value = _mm_add_ps(value, contribute2_sse2(ctx, _mm_add_epi32(xsb, base_i), _mm_add_epi32(ysb, base_i),
+		_mm_sub_ps(dx0, baseOffset), _mm_sub_ps(dy0, baseOffset)));
+
+	//Extra Vertex
+	value = _mm_add_ps(value, contribute2_sse2(ctx, xsv_ext, ysv_ext, dx_ext, dy_ext));
+
+	return _mm_div_ps(value, _mm_set1_ps((float)NORM_CONSTANT_2D));
+}
+
+#endif
+
+void simplex2_batch(struct osn_context *ctx, const float *x, const float *y, float *out, int count)
+{
+	int i = 0;
+
+#if defined(SIMPLEX_SSE2)
+	for (; i + 4 <= count; i += 4)
+		_mm_storeu_ps(out + i, simplex2_sse2(ctx, _mm_loadu_ps(x + i), _mm_loadu_ps(y + i)));
+
+	//Pad the remainder out to a full vector so every point goes through the
+	//same code path, whatever its position in the batch.
+	if (i < count) {
+		float xr[4] = { 0 }, yr[4] = { 0 }, outr[4];
+		int remainder = count - i;
+		memcpy(xr, x + i, sizeof(float) * remainder);
+		memcpy(yr, y + i, sizeof(float) * remainder);
+		_mm_storeu_ps(outr, simplex2_sse2(ctx, _mm_loadu_ps(xr), _mm_loadu_ps(yr)));
+		memcpy(out + i, outr, sizeof(float) * remainder);
+	}
+#else
+	for (; i < count; i++)
+		out[i] = (float)simplex2(ctx, x[i], y[i]);
+#endif
+}
+
 /*
 * 3D OpenSimplex (Simplectic) Noise
 */
@@ -0,0 +1,164 @@
+#include "queue_blocking.h"
+
+#include "utility.h"
+
+void queue_blocking_init(struct queue_blocking* queue, size_t capacity)
+{
+	queue->closed = false;
+
+	queue->capacity = capacity;
+	queue->count = 0;
+	queue->front = 0;
+	queue->back = 0;
+
+	queue->elements = malloc(sizeof(void*) * capacity);
+	check_allocation(queue->elements);
+
+	if (mtx_init(&queue->mutex, mtx_plain) == thrd_error)
+	{
+		log_error_exit("Mutex creation failed.");
+	}
+
+	if (cnd_init(&queue->not_empty) == thrd_error || cnd_init(&queue->not_full) == thrd_error)
+	{
+		log_error_exit("Condition variable creation failed.");
+	}
+}
+
+void queue_blocking_free(struct queue_blocking* queue)
+{
+	queue->capacity = 0;
+	queue->count = 0;
+	queue->front = 0;
+	queue->back = 0;
+
+	free(queue->elements);
+
+	cnd_destroy(&queue->not_full);
+	cnd_destroy(&queue->not_empty);
+	mtx_destroy(&queue->mutex);
+}
+
+void queue_blocking_close(struct queue_blocking* queue)
+{
+	mtx_lock(&queue->mutex);
+
+	queue->closed = true;
+
+	cnd_broadcast(&queue->not_empty);
+	cnd_broadcast(&queue->not_full);
+
+	mtx_unlock(&queue->mutex);
+}
+
+bool queue_blocking_push(struct queue_blocking* queue, void* element)
+{
+	return queue_blocking_push_batch(queue, &element, 1) == 1;
+}
+
+size_t queue_blocking_push_batch(struct queue_blocking* queue, void** elements, size_t count)
+{
+	size_t pushed = 0;
+
+	mtx_lock(&queue->mutex);
+
+	while (pushed < count)
+	{
+		while (queue->count >= queue->capacity && queue->closed == false)
+		{
+			cnd_wait(&queue->not_full, &queue->mutex);
+		}
+
+		if (queue->closed == true)
+		{
+			break;
+		}
+
+		size_t pushed_round = 0;
+
+		while (pushed < count && queue->count < queue->capacity)
+		{
+			queue->elements[queue->back] = elements[pushed++];
+			pushed_round++;
+
+			queue->count++;
+			queue->back++;
+
+			if (queue->back >= queue->capacity)
+			{
+				queue->back = 0;
+			}
+		}
+
+		if (pushed_round == 1)
+		{
+			cnd_signal(&queue->not_empty);
+		}
+		else
+		{
+			// Several consumers may be able to make progress now.
+			cnd_broadcast(&queue->not_empty);
+		}
+	}
+
+	mtx_unlock(&queue->mutex);
+
+	return pushed;
+}
+
+void* queue_blocking_pop(struct queue_blocking* queue)
+{
+	void* element = NULL;
+
+	if (queue_blocking_pop_batch(queue, &element, 1) == 0)
+	{
+		return NULL;
+	}
+
+	return element;
+}
+
+size_t queue_blocking_pop_batch(struct queue_blocking* queue, void** elements, size_t max_count)
+{
+	size_t popped = 0;
+
+	mtx_lock(&queue->mutex);
+
+	while (queue->count == 0 && queue->closed == false)
+	{
+		cnd_wait(&queue->not_empty, &queue->mutex);
+	}
+
+	if (queue->closed == true)
+	{
+		mtx_unlock(&queue->mutex);
+
+		return 0;
+	}
+
+	while (popped < max_count && queue->count > 0)
+	{
+		elements[popped++] = queue->elements[queue->front];
+
+		queue->count--;
+		queue->front++;
+
+		if (queue->front >= queue->capacity)
+		{
+			queue->front = 0;
+		}
+	}
+
+	if (popped == 1)
+	{
+		cnd_signal(&queue->not_full);
+	}
+	else
+	{
+		cnd_broadcast(&queue->not_full);
+	}
+
+	mtx_unlock(&queue->mutex);
+
+	return popped;
+}
@@ -1,13 +1,16 @@
 #include "renderer.h"
 
 #include <stdio.h>
+#include <string.h>
 
 #include <GL/glew.h>
 #include <GLKMath.h>
 
 #include "camera.h"
 #include "chunk.h"
+#include "frustum.h"
 #include "mesher.h"
+#include "occlusion.h"
 #include "shader.h"
 #include "sprite.h"
 #include "texture.h"
@@ -19,14 +22,87 @@
 
 #define DRAW_COMMANDS_CHUNKS_MAX (64 * 64 * 8)
 
-struct DrawArraysCommand
+// Every chunk draws at most one command per face direction.
+#define DRAW_COMMANDS_MAX (DRAW_COMMANDS_CHUNKS_MAX * 6)
+
+// Uniform buffer binding points.
+#define RENDERER_UBO_PALETTE 0
+
+// Shader storage buffer binding points.
+#define RENDERER_SSBO_VERTICES 0
+#define RENDERER_SSBO_CHUNKS 1
+#define RENDERER_SSBO_SLOTS 2
+#define RENDERER_SSBO_COMMANDS 3
+#define RENDERER_SSBO_COUNTERS 4
+
+// Terrain shader uniform locations.
+#define RENDERER_UNIFORM_MATRIX_VP 0
+
+// Cull shader uniform locations.  See cull.comp.glsl.
+#define RENDERER_UNIFORM_CULL_FRUSTUM_PLANES 0
+#define RENDERER_UNIFORM_CULL_CAMERA_POSITION 6
+#define RENDERER_UNIFORM_CULL_VIEW_CHUNK 7
+#define RENDERER_UNIFORM_CULL_VIEW_RADIUS 8
+#define RENDERER_UNIFORM_CULL_SLOT_COUNT 9
+#define RENDERER_UNIFORM_CULL_OCCLUSION_MATRIX 10
+#define RENDERER_UNIFORM_CULL_OCCLUSION_ENABLED 14
+
+// Depth pyramid shader uniform locations.  See depth_pyramid.comp.glsl.
+#define RENDERER_UNIFORM_PYRAMID_SOURCE_LEVEL 0
+
+#define RENDERER_CULL_GROUP_SIZE 64
+#define RENDERER_PYRAMID_GROUP_SIZE 8
+
+// The depth pyramid's first level is half the framebuffer on each axis.
+#define RENDERER_PYRAMID_WIDTH (1920 / 2)
+#define RENDERER_PYRAMID_HEIGHT (1080 / 2)
+
+// Chunks whose centers are within this many voxels of the camera are drawn
+// into the software depth buffer when culling on the CPU, at most
+// RENDERER_OCCLUDERS_MAX of them.
+#define RENDERER_OCCLUDER_DISTANCE 192.0f
+#define RENDERER_OCCLUDERS_MAX 512
+
+struct DrawElementsCommand
 {
 	GLuint count;
 	GLuint instance_count;
-	GLuint first;
+	GLuint first_index;
+	GLint base_vertex;
 	GLuint base_instance;
 };
 
+// What the terrain shaders know about a drawn chunk, read through
+// gl_BaseInstanceARB.  Matches struct chunk in terrain.vert.glsl.
+struct renderer_chunk
+{
+	// Position of the chunk's minimum corner in voxels.
+	GLint x;
+	GLint y;
+	GLint z;
+
+	// Pads the record to an std430 ivec4.
+	GLint padding;
+};
+
+// A chunk as the cull shader sees it, kept from renderer_chunk_update() until
+// renderer_chunk_remove().  Matches struct slot in cull.comp.glsl.  Unused
+// slots have no faces.
+struct renderer_slot
+{
+	GLint x;
+	GLint y;
+	GLint z;
+	GLint padding;
+
+	// The mesh's faces by normal, as in chunk_mesh.faces.
+	struct
+	{
+		GLint first;
+		GLint count;
+	} faces[6];
+};
+
 struct renderer
 {
 	GLuint framebuffer;
@@ -36,11 +112,18 @@ struct renderer
 	SHADER shader_fullquad;
 	SHADER shader_sprite;
 	SHADER shader_terrain;
+	SHADER shader_cull;
+	SHADER shader_depth_pyramid;
 
 	GLuint vao_chunks;
-	GLuint vbo_chunks_matrices;
+	GLuint ssbo_chunks;
 	GLuint vbo_chunks_commands;
-	GLKMatrix4 vbo_chunk_matrices_buffer[DRAW_COMMANDS_CHUNKS_MAX];
+	GLuint ibo_chunks_quads;
+#if defined(VOXEL_COMPACT_VERTICES)
+	GLuint ubo_palette;
+	unsigned int palette_version;
+#endif
+	struct renderer_chunk chunks[DRAW_COMMANDS_CHUNKS_MAX];
 	GLuint vao_fullquad;
 	GLuint vbo_fullquad;
 	GLuint vao_sprite;
@@ -50,7 +133,51 @@ struct renderer
 	GLKMatrix4 matrix_projection3D;
 	GLKMatrix4 matrix_view;
 
-	struct DrawArraysCommand draw_commands_chunks[DRAW_COMMANDS_CHUNKS_MAX];
+	// Chunks passed to render_chunk() this frame and their bounds, culled
+	// against the view frustum before any commands are built for them.
+	struct chunk* chunks_submitted[DRAW_COMMANDS_CHUNKS_MAX];
+	float chunks_submitted_center[3][DRAW_COMMANDS_CHUNKS_MAX];
+	float chunks_submitted_extent[3][DRAW_COMMANDS_CHUNKS_MAX];
+	uint32_t chunks_visible[DRAW_COMMANDS_CHUNKS_MAX];
+	size_t chunks_submitted_count;
+
+	// Occlusion culling on the CPU.  The solid layers of chunks near the
+	// camera are rasterized into a small depth buffer and chunks that passed
+	// the frustum are tested against it.  Uniformly solid chunks have no mesh
+	// and are only submitted as occluders.
+	bool occlusion_culling;
+	struct occlusion_buffer occlusion;
+	struct chunk* occluders_solid[RENDERER_OCCLUDERS_MAX];
+	size_t occluders_solid_count;
+
+	// GPU culling.  Every chunk with a mesh keeps a slot in ssbo_slots, so
+	// the CPU only touches chunks whose mesh changed.  The cull shader fills
+	// ssbo_chunks and the command buffer from the slots each frame and the
+	// draw count is read from ssbo_counters.
+	bool gpu_culling_available;
+	bool gpu_culling;
+	GLuint ssbo_slots;
+	GLuint ssbo_counters;
+	struct renderer_slot slots[DRAW_COMMANDS_CHUNKS_MAX];
+	size_t slots_length;
+	GLint slots_free[DRAW_COMMANDS_CHUNKS_MAX];
+	size_t slots_free_count;
+
+	// Slots changed since they were last uploaded, as a range.
+	size_t slots_dirty_begin;
+	size_t slots_dirty_end;
+
+	// Furthest depth per texel of the previous frame, halving in size per
+	// level, and the matrix that frame was drawn with.
+	GLuint depth_pyramid;
+	int depth_pyramid_levels;
+	bool depth_pyramid_valid;
+	GLKMatrix4 matrix_vp_previous;
+
+	// Commands index their chunk's record through base_instance.  A chunk
+	// can take several commands when some of its faces are culled.
+	struct DrawElementsCommand draw_commands[DRAW_COMMANDS_MAX];
+	size_t draw_commands_count;
 	size_t draw_commands_chunks_count;
 
 	TEXTURE texture_noise;
@@ -59,6 +186,12 @@ struct renderer
 
 static struct renderer renderer = { 0 };
 
+static void render_chunk_commands(struct chunk* chunk);
+static bool render_chunk_near(const struct chunk* chunk);
+static void render_chunk_occluders(const struct chunk* chunk);
+static void render_cull_cpu(const struct frustum* frustum, GLKMatrix4 matrix_vp);
+static void render_cull_gpu(const struct frustum* frustum);
+static void render_depth_pyramid(GLKMatrix4 matrix_vp);
 static void render_sprite(struct sprite sprite);
 
 bool renderer_initialize(void)
@@ -81,6 +214,20 @@ bool renderer_initialize(void)
 		printf("OpenGL 4.5 API is not available.\n");
 	}
 
+	if (!GLEW_ARB_shader_draw_parameters)
+	{
+		printf("GL_ARB_shader_draw_parameters is not available.\n");
+	}
+
+	// Culling on the GPU needs the draw count to come from a buffer.
+	renderer.gpu_culling_available = GLEW_ARB_indirect_parameters;
+	renderer.gpu_culling = renderer.gpu_culling_available;
+
+	if (!GLEW_ARB_indirect_parameters)
+	{
+		printf("GL_ARB_indirect_parameters is not available, culling on the CPU.\n");
+	}
+
 	glEnable(GL_MULTISAMPLE);
 	glEnable(GL_TEXTURE_2D);
 	glEnable(GL_DEPTH_TEST);
@@ -102,50 +249,119 @@ bool renderer_initialize(void)
 	
 	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, renderer.framebuffer_color, 0);
 
-	glGenRenderbuffers(1, &renderer.framebuffer_depth);
-	glBindRenderbuffer(GL_RENDERBUFFER, renderer.framebuffer_depth);
-	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, 1920, 1080);
+	// A texture rather than a renderbuffer so the depth pyramid can be built
+	// from it.
+	glGenTextures(1, &renderer.framebuffer_depth);
+	glBindTexture(GL_TEXTURE_2D, renderer.framebuffer_depth);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH24_STENCIL8, 1920, 1080);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 
-	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, renderer.framebuffer_depth);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, renderer.framebuffer_depth, 0);
 
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
 	// Initialize shaders
 	renderer.shader_fullquad = shader_create(SHADER_ASSET_DIRECTORY "fullquad.vert.glsl", SHADER_ASSET_DIRECTORY "fullquad.frag.glsl");
 	renderer.shader_sprite = shader_create(SHADER_ASSET_DIRECTORY "sprite.vert.glsl", SHADER_ASSET_DIRECTORY "sprite.frag.glsl");
+#if defined(VOXEL_COMPACT_VERTICES)
+	renderer.shader_terrain = shader_create(SHADER_ASSET_DIRECTORY "terrain_compact.vert.glsl", SHADER_ASSET_DIRECTORY "terrain.frag.glsl");
+
+	// Colors for the palette indices in compact vertices.  std140 pads each
+	// entry to a vec4.
+	glGenBuffers(1, &renderer.ubo_palette);
+	glBindBuffer(GL_UNIFORM_BUFFER, renderer.ubo_palette);
+	glBufferData(GL_UNIFORM_BUFFER, CHUNK_PALETTE_CAPACITY * sizeof(GLKVector4), NULL, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	glUniformBlockBinding(renderer.shader_terrain, glGetUniformBlockIndex(renderer.shader_terrain, "palette"), RENDERER_UBO_PALETTE);
+	glBindBufferBase(GL_UNIFORM_BUFFER, RENDERER_UBO_PALETTE, renderer.ubo_palette);
+#else
 	renderer.shader_terrain = shader_create(SHADER_ASSET_DIRECTORY "terrain.vert.glsl", SHADER_ASSET_DIRECTORY "terrain.frag.glsl");
+#endif
 
-	// Initialize VAO and VBOs for rendering chunks.
+	// Initialize VAO and buffers for rendering chunks.  The terrain shaders
+	// pull their vertices and chunk records from shader storage buffers, so
+	// the VAO only holds the index buffer.
 	glGenVertexArrays(1, &renderer.vao_chunks);
 	glBindVertexArray(renderer.vao_chunks);
 
 	mesher_setup_opengl_buffer();
 
-	glGenBuffers(1, &renderer.vbo_chunks_matrices);
-	glBindBuffer(GL_ARRAY_BUFFER, renderer.vbo_chunks_matrices);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, RENDERER_SSBO_VERTICES, mesher_vbo_get());
+
+	// Every chunk mesh is a list of 4 vertex quads, so one index buffer drawn
+	// from each mesh's base vertex serves them all.  The VAO keeps it bound.
+	GLuint* quad_indices = malloc(CHUNK_MESH_QUADS_MAX * 6 * sizeof(GLuint));
+	check_allocation(quad_indices);
+
+	for (GLuint i = 0; i < CHUNK_MESH_QUADS_MAX; i++)
+	{
+		quad_indices[i * 6 + 0] = i * 4 + 0;
+		quad_indices[i * 6 + 1] = i * 4 + 1;
+		quad_indices[i * 6 + 2] = i * 4 + 2;
+		quad_indices[i * 6 + 3] = i * 4 + 3;
+		quad_indices[i * 6 + 4] = i * 4 + 0;
+		quad_indices[i * 6 + 5] = i * 4 + 2;
+	}
+
+	glGenBuffers(1, &renderer.ibo_chunks_quads);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, renderer.ibo_chunks_quads);
+	glBufferStorage(GL_ELEMENT_ARRAY_BUFFER, CHUNK_MESH_QUADS_MAX * 6 * sizeof(GLuint), quad_indices, 0);
 
-	glBufferData(GL_ARRAY_BUFFER, DRAW_COMMANDS_CHUNKS_MAX * sizeof(GLKMatrix4), NULL, GL_STREAM_DRAW);
+	free(quad_indices);
 
-	glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(GLKMatrix4), (GLvoid*)(sizeof(GLKVector4) * 0));
-	glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(GLKMatrix4), (GLvoid*)(sizeof(GLKVector4) * 1));
-	glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(GLKMatrix4), (GLvoid*)(sizeof(GLKVector4) * 2));
-	glVertexAttribPointer(5, 4, GL_FLOAT, GL_FALSE, sizeof(GLKMatrix4), (GLvoid*)(sizeof(GLKVector4) * 3));
+	glGenBuffers(1, &renderer.ssbo_chunks);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, renderer.ssbo_chunks);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, DRAW_COMMANDS_CHUNKS_MAX * sizeof(struct renderer_chunk), NULL, GL_STREAM_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 
-	glEnableVertexAttribArray(2);
-	glEnableVertexAttribArray(3);
-	glEnableVertexAttribArray(4);
-	glEnableVertexAttribArray(5);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, RENDERER_SSBO_CHUNKS, renderer.ssbo_chunks);
 
-	glVertexAttribDivisor(2, 1);
-	glVertexAttribDivisor(3, 1);
-	glVertexAttribDivisor(4, 1);
-	glVertexAttribDivisor(5, 1);
+	glGenBuffers(1, &renderer.ssbo_slots);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, renderer.ssbo_slots);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, DRAW_COMMANDS_CHUNKS_MAX * sizeof(struct renderer_slot), NULL, GL_DYNAMIC_DRAW);
+
+	// The draw count first, where the draw reads it, then the chunk count.
+	glGenBuffers(1, &renderer.ssbo_counters);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, renderer.ssbo_counters);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, 2 * sizeof(GLuint), NULL, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, RENDERER_SSBO_SLOTS, renderer.ssbo_slots);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, RENDERER_SSBO_COUNTERS, renderer.ssbo_counters);
+
+	renderer.slots_length = 0;
+	renderer.slots_free_count = 0;
+	renderer.slots_dirty_begin = DRAW_COMMANDS_CHUNKS_MAX;
+	renderer.slots_dirty_end = 0;
 
 	glGenBuffers(1, &renderer.vbo_chunks_commands);
 	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, renderer.vbo_chunks_commands);
-	glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(struct DrawArraysCommand) * DRAW_COMMANDS_CHUNKS_MAX, NULL, GL_STREAM_DRAW);
+	glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(struct DrawElementsCommand) * DRAW_COMMANDS_MAX, NULL, GL_STREAM_DRAW);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, RENDERER_SSBO_COMMANDS, renderer.vbo_chunks_commands);
+
+	// Shaders and depth pyramid for culling on the GPU.
+	renderer.shader_cull = shader_create_compute(SHADER_ASSET_DIRECTORY "cull.comp.glsl");
+	renderer.shader_depth_pyramid = shader_create_compute(SHADER_ASSET_DIRECTORY "depth_pyramid.comp.glsl");
+
+	renderer.depth_pyramid_levels = 1;
+
+	while ((max(RENDERER_PYRAMID_WIDTH, RENDERER_PYRAMID_HEIGHT) >> renderer.depth_pyramid_levels) > 0)
+	{
+		renderer.depth_pyramid_levels++;
+	}
+
+	glGenTextures(1, &renderer.depth_pyramid);
+	glBindTexture(GL_TEXTURE_2D, renderer.depth_pyramid);
+	glTexStorage2D(GL_TEXTURE_2D, renderer.depth_pyramid_levels, GL_R32F, RENDERER_PYRAMID_WIDTH, RENDERER_PYRAMID_HEIGHT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	renderer.depth_pyramid_valid = false;
 
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	glBindVertexArray(0);
 
 	// Initialize fullquad geometry.  Two float for position and two floats for
@@ -206,6 +422,10 @@ bool renderer_initialize(void)
 	camera_init();
 
 	// Draw command stuff
+	renderer.chunks_submitted_count = 0;
+	renderer.occluders_solid_count = 0;
+	renderer.occlusion_culling = true;
+	renderer.draw_commands_count = 0;
 	renderer.draw_commands_chunks_count = 0;
 
 	// Noise experiments
@@ -262,19 +482,81 @@ void renderer_render(void)
 	glBindFramebuffer(GL_FRAMEBUFFER, renderer.framebuffer);
 	glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
 
+#if defined(VOXEL_COMPACT_VERTICES)
+	// Upload the palette when the mesher has added colors to it.
+	struct color palette[CHUNK_PALETTE_CAPACITY];
+	unsigned int palette_version = mesher_palette_get(palette);
+
+	if (palette_version != renderer.palette_version)
+	{
+		GLKVector4 palette_colors[CHUNK_PALETTE_CAPACITY];
+
+		for (int i = 0; i < CHUNK_PALETTE_CAPACITY; i++)
+		{
+			palette_colors[i] = GLKVector4Make(palette[i].r / 255.0f, palette[i].g / 255.0f, palette[i].b / 255.0f, palette[i].a / 255.0f);
+		}
+
+		glBindBuffer(GL_UNIFORM_BUFFER, renderer.ubo_palette);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(palette_colors), palette_colors);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+		renderer.palette_version = palette_version;
+	}
+#endif
+
+	// Chunks are placed by their records, so one matrix serves them all.
+	GLKMatrix4 matrix_vp = GLKMatrix4Multiply(renderer.matrix_projection3D, renderer.matrix_view);
+
+	struct frustum frustum;
+	frustum_extract(&frustum, matrix_vp);
+
+	if (renderer.gpu_culling == true)
+	{
+		render_cull_gpu(&frustum);
+	}
+	else
+	{
+		render_cull_cpu(&frustum, matrix_vp);
+	}
+
 	// Render the chunks.
 	shader_use(renderer.shader_terrain);
 	glBindVertexArray(renderer.vao_chunks);
 
-	glBindBuffer(GL_ARRAY_BUFFER, renderer.vbo_chunks_matrices);
-	glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(GLKMatrix4) * renderer.draw_commands_chunks_count, renderer.vbo_chunk_matrices_buffer);
+	glUniformMatrix4fv(RENDERER_UNIFORM_MATRIX_VP, 1, GL_FALSE, (const GLfloat*)&matrix_vp);
 
 	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, renderer.vbo_chunks_commands);
-	glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, sizeof(struct DrawArraysCommand) * renderer.draw_commands_chunks_count, renderer.draw_commands_chunks);
 
-	glMultiDrawArraysIndirect(GL_TRIANGLES, NULL, renderer.draw_commands_chunks_count, 0);
+	if (renderer.gpu_culling == true)
+	{
+		glBindBuffer(GL_PARAMETER_BUFFER_ARB, renderer.ssbo_counters);
+		glMultiDrawElementsIndirectCountARB(GL_TRIANGLES, GL_UNSIGNED_INT, NULL, 0, DRAW_COMMANDS_MAX, 0);
+		glBindBuffer(GL_PARAMETER_BUFFER_ARB, 0);
+	}
+	else
+	{
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, renderer.ssbo_chunks);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(struct renderer_chunk) * renderer.draw_commands_chunks_count, renderer.chunks);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+		glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, sizeof(struct DrawElementsCommand) * renderer.draw_commands_count, renderer.draw_commands);
+
+		glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, NULL, renderer.draw_commands_count, 0);
+	}
+
 	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
 
+	if (renderer.gpu_culling == true)
+	{
+		render_depth_pyramid(matrix_vp);
+	}
+
+	// Meshes released before this frame stop being read once it completes.
+	mesher_fence_frame();
+
+	renderer.chunks_submitted_count = 0;
+	renderer.occluders_solid_count = 0;
+	renderer.draw_commands_count = 0;
 	renderer.draw_commands_chunks_count = 0;
 
 	glBindVertexArray(0);
@@ -305,101 +587,361 @@ void renderer_render(void)
 
 void render_chunk(struct chunk* chunk)
 {
+	// The GPU culls the chunks' slots instead.
+	if (renderer.gpu_culling == true)
+	{
+		return;
+	}
+
 	if (chunk->mesh == NULL)
 	{
+		if (chunk->contents == CHUNK_CONTENTS_SOLID && renderer.occluders_solid_count < RENDERER_OCCLUDERS_MAX && render_chunk_near(chunk) == true)
+		{
+			renderer.occluders_solid[renderer.occluders_solid_count++] = chunk;
+		}
+
 		return;
 	}
 
-	GLKMatrix4 matrix_mv = GLKMatrix4Multiply(renderer.matrix_view, chunk->transform.matrix);
-	GLKMatrix4 matrix_mvp = GLKMatrix4Multiply(renderer.matrix_projection3D, matrix_mv);
-
-	// Frustum culling.
-	/*
-	GLKVector4 frustum_planes[6];
-
-	// Left plane.
-	frustum_planes[0].x = matrix_mvp.m03 + matrix_mvp.m00;
-	frustum_planes[0].y = matrix_mvp.m13 + matrix_mvp.m10;
-	frustum_planes[0].z = matrix_mvp.m23 + matrix_mvp.m20;
-	frustum_planes[0].w = matrix_mvp.m33 + matrix_mvp.m30;
-
-	// Right plane.
-	frustum_planes[1].x = matrix_mvp.m03 - matrix_mvp.m00;
-	frustum_planes[1].y = matrix_mvp.m13 - matrix_mvp.m10;
-	frustum_planes[1].z = matrix_mvp.m23 - matrix_mvp.m20;
-	frustum_planes[1].w = matrix_mvp.m33 - matrix_mvp.m30;
-
-	// Bottom plane.
-	frustum_planes[2].x = matrix_mvp.m03 + matrix_mvp.m01;
-	frustum_planes[2].y = matrix_mvp.m13 + matrix_mvp.m11;
-	frustum_planes[2].z = matrix_mvp.m23 + matrix_mvp.m21;
-	frustum_planes[2].w = matrix_mvp.m33 + matrix_mvp.m31;
-
-	// Top plane.
-	frustum_planes[3].x = matrix_mvp.m03 - matrix_mvp.m01;
-	frustum_planes[3].y = matrix_mvp.m13 - matrix_mvp.m11;
-	frustum_planes[3].z = matrix_mvp.m23 - matrix_mvp.m21;
-	frustum_planes[3].w = matrix_mvp.m33 - matrix_mvp.m31;
-
-	// Near plane.
-	frustum_planes[4].x = matrix_mvp.m03 + matrix_mvp.m02;
-	frustum_planes[4].y = matrix_mvp.m13 + matrix_mvp.m12;
-	frustum_planes[4].z = matrix_mvp.m23 + matrix_mvp.m22;
-	frustum_planes[4].w = matrix_mvp.m33 + matrix_mvp.m32;
-
-	// Far plane.
-	frustum_planes[5].x = matrix_mvp.m03 - matrix_mvp.m02;
-	frustum_planes[5].y = matrix_mvp.m13 - matrix_mvp.m12;
-	frustum_planes[5].z = matrix_mvp.m23 - matrix_mvp.m22;
-	frustum_planes[5].w = matrix_mvp.m33 - matrix_mvp.m32;
-
-	for (int i = 0; i < 6; i++)
-	{
-		int in = 0;
-		int out = 0;
-
-		for (int j = 0; j < 8; j++)
+	if (renderer.chunks_submitted_count == DRAW_COMMANDS_CHUNKS_MAX)
+	{
+		return;
+	}
+
+	size_t index = renderer.chunks_submitted_count++;
+
+	renderer.chunks_submitted[index] = chunk;
+
+	for (int axis = 0; axis < 3; axis++)
+	{
+		renderer.chunks_submitted_center[axis][index] = (chunk->aabb.min.v[axis] + chunk->aabb.max.v[axis]) * 0.5f;
+		renderer.chunks_submitted_extent[axis][index] = (chunk->aabb.max.v[axis] - chunk->aabb.min.v[axis]) * 0.5f;
+	}
+}
+
+// Adds the draw commands and record for a chunk that passed frustum culling.
+static void render_chunk_commands(struct chunk* chunk)
+{
+	// Backface culling at the chunk level.  Faces pointing along +axis can
+	// only be seen from beyond the chunk's minimum on that axis, and faces
+	// pointing along -axis from below its maximum.
+	GLKVector3 min = chunk->aabb.min;
+	GLKVector3 max = chunk->aabb.max;
+
+	bool visible[6] =
+	{
+		Camera.position.y < max.y,
+		Camera.position.y > min.y,
+		Camera.position.z < max.z,
+		Camera.position.z > min.z,
+		Camera.position.x < max.x,
+		Camera.position.x > min.x,
+	};
+
+	// Add the draw calls.  The mesh stores its faces by normal, so runs of
+	// visible directions are contiguous and merge into a single command.
+	size_t chunk_index = renderer.draw_commands_chunks_count;
+
+	struct DrawElementsCommand* command = NULL;
+
+	for (int normal = 0; normal < 6; normal++)
+	{
+		GLsizei count = chunk->mesh->faces[normal].count;
+
+		if (visible[normal] == false || count == 0)
 		{
-			float d =
-				frustum_planes[i].x * chunk->corners[j].x +
-				frustum_planes[i].y * chunk->corners[j].y +
-				frustum_planes[i].z * chunk->corners[j].z +
-				frustum_planes[i].w;
-
-			if (d < 0)
-			{
-				out++;
-			}
-			else
-			{
-				in++;
-			}
-
-			if (in && out)
-			{
-				break;
-			}
+			command = NULL;
+			continue;
 		}
 
-		if (in == 0)
+		if (command == NULL)
 		{
-			// Cull the chunk.
+			command = &renderer.draw_commands[renderer.draw_commands_count++];
+
+			command->count = 0;
+			command->instance_count = 1;
+			command->first_index = 0;
+			command->base_vertex = chunk->mesh->faces[normal].first;
+			command->base_instance = (GLuint)chunk_index;
+		}
+
+		command->count += count / 4 * 6;
+	}
+
+	struct renderer_chunk* record = &renderer.chunks[chunk_index];
+
+	record->x = chunk->x * CHUNK_LENGTH;
+	record->y = chunk->y * CHUNK_LENGTH;
+	record->z = chunk->z * CHUNK_LENGTH;
+	record->padding = 0;
+
+	renderer.draw_commands_chunks_count++;
+}
+
+// Whether the chunk is close enough to the camera to be drawn as an occluder.
+static bool render_chunk_near(const struct chunk* chunk)
+{
+	GLKVector3 center = GLKVector3MultiplyScalar(GLKVector3Add(chunk->aabb.min, chunk->aabb.max), 0.5f);
+
+	return GLKVector3Distance(center, Camera.position) < RENDERER_OCCLUDER_DISTANCE;
+}
+
+// Draws the chunk's runs of solid layers into the occlusion buffer.
+static void render_chunk_occluders(const struct chunk* chunk)
+{
+	if (chunk->mesh == NULL)
+	{
+		occlusion_rasterize_box(&renderer.occlusion, chunk->aabb);
+
+		return;
+	}
+
+	for (int axis = 0; axis < 3; axis++)
+	{
+		struct chunk_mesh_occluder run = chunk->mesh->occluders[axis];
+
+		if (run.begin == run.end)
+		{
+			continue;
+		}
+
+		struct aabb box = chunk->aabb;
+		box.min.v[axis] = chunk->aabb.min.v[axis] + run.begin;
+		box.max.v[axis] = chunk->aabb.min.v[axis] + run.end;
+
+		occlusion_rasterize_box(&renderer.occlusion, box);
+
+		// A run through the whole chunk is the same box on every axis.
+		if (run.begin == 0 && run.end == CHUNK_LENGTH)
+		{
+			break;
+		}
+	}
+}
+
+// Frustum culls the chunks submitted with render_chunk() in batches and
+// builds draw commands for the survivors only.
+static void render_cull_cpu(const struct frustum* frustum, GLKMatrix4 matrix_vp)
+{
+	struct frustum_boxes boxes =
+	{
+		.center = { renderer.chunks_submitted_center[0], renderer.chunks_submitted_center[1], renderer.chunks_submitted_center[2] },
+		.extent = { renderer.chunks_submitted_extent[0], renderer.chunks_submitted_extent[1], renderer.chunks_submitted_extent[2] },
+		.count = renderer.chunks_submitted_count,
+	};
+
+	size_t visible_count = frustum_cull_boxes(frustum, &boxes, renderer.chunks_visible);
+
+	if (renderer.occlusion_culling == false)
+	{
+		for (size_t i = 0; i < visible_count; i++)
+		{
+			render_chunk_commands(renderer.chunks_submitted[renderer.chunks_visible[i]]);
+		}
+
+		return;
+	}
+
+	occlusion_begin(&renderer.occlusion, matrix_vp, Camera.position);
+
+	size_t occluder_count = 0;
+
+	for (size_t i = 0; i < renderer.occluders_solid_count; i++)
+	{
+		render_chunk_occluders(renderer.occluders_solid[i]);
+	}
+
+	for (size_t i = 0; i < visible_count && occluder_count < RENDERER_OCCLUDERS_MAX; i++)
+	{
+		struct chunk* chunk = renderer.chunks_submitted[renderer.chunks_visible[i]];
+
+		if (render_chunk_near(chunk) == true)
+		{
+			render_chunk_occluders(chunk);
+
+			occluder_count++;
+		}
+	}
+
+	occlusion_build_pyramid(&renderer.occlusion);
+
+	for (size_t i = 0; i < visible_count; i++)
+	{
+		struct chunk* chunk = renderer.chunks_submitted[renderer.chunks_visible[i]];
+
+		if (occlusion_test_box(&renderer.occlusion, chunk->aabb) == true)
+		{
+			render_chunk_commands(chunk);
+		}
+	}
+}
+
+// Culls every slot on the GPU, leaving the chunk records, draw commands and
+// draw count in their buffers.  Occlusion is tested against the previous
+// frame's depth, so a chunk coming out from behind terrain is drawn a frame
+// late.
+static void render_cull_gpu(const struct frustum* frustum)
+{
+	if (renderer.slots_dirty_begin < renderer.slots_dirty_end)
+	{
+		size_t begin = renderer.slots_dirty_begin;
+		size_t end = renderer.slots_dirty_end;
+
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, renderer.ssbo_slots);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, begin * sizeof(struct renderer_slot), (end - begin) * sizeof(struct renderer_slot), &renderer.slots[begin]);
+
+		renderer.slots_dirty_begin = DRAW_COMMANDS_CHUNKS_MAX;
+		renderer.slots_dirty_end = 0;
+	}
+
+	GLuint counters[2] = { 0, 0 };
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, renderer.ssbo_counters);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(counters), counters);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	shader_use(renderer.shader_cull);
+
+	glUniform4fv(RENDERER_UNIFORM_CULL_FRUSTUM_PLANES, 6, (const GLfloat*)frustum->planes);
+	glUniform3fv(RENDERER_UNIFORM_CULL_CAMERA_POSITION, 1, Camera.position.v);
+	glUniform2i(RENDERER_UNIFORM_CULL_VIEW_CHUNK, (int)(Camera.position.x / CHUNK_LENGTH), (int)(Camera.position.z / CHUNK_LENGTH));
+	glUniform1i(RENDERER_UNIFORM_CULL_VIEW_RADIUS, world_chunk_radius_get());
+	glUniform1ui(RENDERER_UNIFORM_CULL_SLOT_COUNT, (GLuint)renderer.slots_length);
+	glUniformMatrix4fv(RENDERER_UNIFORM_CULL_OCCLUSION_MATRIX, 1, GL_FALSE, (const GLfloat*)&renderer.matrix_vp_previous);
+	glUniform1i(RENDERER_UNIFORM_CULL_OCCLUSION_ENABLED, renderer.depth_pyramid_valid);
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, renderer.depth_pyramid);
+
+	glDispatchCompute((GLuint)(renderer.slots_length + RENDERER_CULL_GROUP_SIZE - 1) / RENDERER_CULL_GROUP_SIZE, 1, 1);
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+	shader_use(SHADER_NULL);
+
+	// The draw reads the commands and count as indirect parameters and the
+	// terrain shader reads the chunk records.
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+// Builds the depth pyramid from the frame's depth buffer for the next frame's
+// occlusion tests.
+static void render_depth_pyramid(GLKMatrix4 matrix_vp)
+{
+	shader_use(renderer.shader_depth_pyramid);
+
+	glActiveTexture(GL_TEXTURE0);
+
+	int width = RENDERER_PYRAMID_WIDTH;
+	int height = RENDERER_PYRAMID_HEIGHT;
+
+	for (int level = 0; level < renderer.depth_pyramid_levels; level++)
+	{
+		// Each level is reduced from the one before, and the first from the
+		// depth buffer.
+		glBindTexture(GL_TEXTURE_2D, level == 0 ? renderer.framebuffer_depth : renderer.depth_pyramid);
+		glUniform1i(RENDERER_UNIFORM_PYRAMID_SOURCE_LEVEL, level == 0 ? 0 : level - 1);
+
+		glBindImageTexture(0, renderer.depth_pyramid, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+
+		glDispatchCompute((width + RENDERER_PYRAMID_GROUP_SIZE - 1) / RENDERER_PYRAMID_GROUP_SIZE, (height + RENDERER_PYRAMID_GROUP_SIZE - 1) / RENDERER_PYRAMID_GROUP_SIZE, 1);
+
+		glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+		width = max(width / 2, 1);
+		height = max(height / 2, 1);
+	}
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+	shader_use(SHADER_NULL);
+
+	renderer.matrix_vp_previous = matrix_vp;
+	renderer.depth_pyramid_valid = true;
+}
+
+void renderer_chunk_update(struct chunk* chunk)
+{
+	if (chunk->mesh == NULL)
+	{
+		renderer_chunk_remove(chunk);
+
+		return;
+	}
+
+	if (chunk->render_slot < 0)
+	{
+		if (renderer.slots_free_count > 0)
+		{
+			chunk->render_slot = renderer.slots_free[--renderer.slots_free_count];
+		}
+		else if (renderer.slots_length < DRAW_COMMANDS_CHUNKS_MAX)
+		{
+			chunk->render_slot = (GLint)renderer.slots_length++;
+		}
+		else
+		{
+			// Out of slots.  The chunk is only drawn when culling on the CPU.
 			return;
 		}
 	}
-	*/
 
-	// Add the draw call.
-	renderer.vbo_chunk_matrices_buffer[renderer.draw_commands_chunks_count] = matrix_mvp;
+	size_t index = (size_t)chunk->render_slot;
+	struct renderer_slot* slot = &renderer.slots[index];
 
-	struct DrawArraysCommand* command = &renderer.draw_commands_chunks[renderer.draw_commands_chunks_count];
+	slot->x = chunk->x * CHUNK_LENGTH;
+	slot->y = chunk->y * CHUNK_LENGTH;
+	slot->z = chunk->z * CHUNK_LENGTH;
+	slot->padding = 0;
+
+	for (int normal = 0; normal < 6; normal++)
+	{
+		slot->faces[normal].first = chunk->mesh->faces[normal].first;
+		slot->faces[normal].count = chunk->mesh->faces[normal].count;
+	}
 
-	command->first = chunk->mesh->first;
-	command->count = chunk->mesh->count;
-	command->instance_count = 1;
-	command->base_instance = renderer.draw_commands_chunks_count;
+	renderer.slots_dirty_begin = min(renderer.slots_dirty_begin, index);
+	renderer.slots_dirty_end = max(renderer.slots_dirty_end, index + 1);
+}
 
-	renderer.draw_commands_chunks_count++;
+void renderer_chunk_remove(struct chunk* chunk)
+{
+	if (chunk->render_slot < 0)
+	{
+		return;
+	}
+
+	size_t index = (size_t)chunk->render_slot;
+
+	memset(&renderer.slots[index], 0, sizeof(struct renderer_slot));
+
+	renderer.slots_free[renderer.slots_free_count++] = chunk->render_slot;
+
+	renderer.slots_dirty_begin = min(renderer.slots_dirty_begin, index);
+	renderer.slots_dirty_end = max(renderer.slots_dirty_end, index + 1);
+
+	chunk->render_slot = -1;
+}
+
+bool renderer_gpu_culling_get(void)
+{
+	return renderer.gpu_culling;
+}
+
+void renderer_gpu_culling_set(bool enabled)
+{
+	renderer.gpu_culling = enabled && renderer.gpu_culling_available;
+
+	// The pyramid is only kept up to date while culling on the GPU.
+	renderer.depth_pyramid_valid = false;
+}
+
+bool renderer_occlusion_culling_get(void)
+{
+	return renderer.occlusion_culling;
+}
+
+void renderer_occlusion_culling_set(bool enabled)
+{
+	renderer.occlusion_culling = enabled;
 }
 
 void render_sprite(struct sprite sprite)
@@ -145,6 +145,77 @@ cleanup:
 	return shader;
 }
 
+SHADER shader_create_compute(const char* comp_path)
+{
+	SHADER shader = 0;
+
+	char* comp_source = NULL;
+
+	// Load the compute shader source.  If any part fails jump to cleanup.
+	FILE* comp_file = fopen(comp_path, "rb");
+
+	if (comp_file == NULL)
+	{
+		goto cleanup;
+	}
+
+	fseek(comp_file, 0, SEEK_END);
+	long comp_length = ftell(comp_file);
+	rewind(comp_file);
+
+	comp_source = (char*)malloc(comp_length + 1);
+
+	if (comp_source == NULL)
+	{
+		goto cleanup;
+	}
+
+	if (fread(comp_source, 1, comp_length, comp_file) != comp_length)
+	{
+		goto cleanup;
+	}
+
+	comp_source[comp_length] = 0;
+
+	// Compile the compute shader.
+	GLuint comp_shader = glCreateShader(GL_COMPUTE_SHADER);
+
+	glShaderSource(comp_shader, 1, (const GLchar**)&comp_source, NULL);
+
+	glCompileShader(comp_shader);
+
+	GLint compile_status = 0;
+	glGetShaderiv(comp_shader, GL_COMPILE_STATUS, &compile_status);
+
+	if (compile_status == GL_FALSE)
+	{
+		char error[4096];
+		GLsizei error_length;
+
+		glGetShaderInfoLog(comp_shader, sizeof(error), &error_length, error);
+
+		printf("%.*s\n", (int)error_length, error);
+	}
+
+	shader = glCreateProgram();
+
+	glAttachShader(shader, comp_shader);
+
+	glLinkProgram(shader);
+
+	glDeleteShader(comp_shader);
+
+cleanup:
+	free(comp_source);
+
+	if (comp_file != NULL)
+	{
+		fclose(comp_file);
+	}
+
+	return shader;
+}
+
 void shader_use(SHADER shader)
 {
 	glUseProgram(shader);
@@ -0,0 +1,11 @@
+#include "timer.h"
+
+#include "tinycthread.h"
+
+double timer_seconds(void)
+{
+	struct _ttherad_timespec time_now = { 0 };
+	timespec_get(&time_now, TIME_UTC);
+
+	return (double)time_now.tv_sec + (double)time_now.tv_nsec / 1000000000.0;
+}
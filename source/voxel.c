@@ -25,6 +25,24 @@ void voxel_main_loop(void)
 			break;
 		}
 
+		if (keyboard_key(GLFW_KEY_G).released == true)
+		{
+			// Cycle the meshing mode.  Only chunks meshed afterwards change.
+			mesher_mode_set((mesher_mode_get() + 1) % MESHER_MODE_COUNT);
+		}
+
+		if (keyboard_key(GLFW_KEY_C).released == true)
+		{
+			// Switch between culling chunks on the GPU and the CPU.
+			renderer_gpu_culling_set(renderer_gpu_culling_get() == false);
+		}
+
+		if (keyboard_key(GLFW_KEY_O).released == true)
+		{
+			// Switch occlusion culling on the CPU on and off.
+			renderer_occlusion_culling_set(renderer_occlusion_culling_get() == false);
+		}
+
 		renderer_update();
 
 		world_tick();
@@ -53,12 +71,14 @@ int main(int argc, char** argv)
 
 	log_opengl_errors();
 
-	if (mesher_start_thread() == false)
+	if (mesher_start_threads(0) == false)
 	{
 		return -1;
 	}
 
-	if (generator_start_thread() == false)
+	mesher_mode_set(MESHER_MODE_BINARY_GREEDY);
+
+	if (generator_start_threads(0) == false)
 	{
 		return -1;
 	}
@@ -67,8 +87,8 @@ int main(int argc, char** argv)
 
 	voxel_main_loop();
 
-	generator_stop_thread();
-	mesher_stop_thread();
+	generator_stop_threads();
+	mesher_stop_threads();
 
 	return 0;
 }
@@ -0,0 +1,281 @@
+#include <stdio.h>
+
+#include "camera.h"
+#include "generator.h"
+#include "mesher.h"
+#include "timer.h"
+#include "world.h"
+#include "utility.h"
+
+#include "tinycthread.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+// Headless world streaming benchmark.  Runs the world, generator and mesher
+// without a window while flying the camera along a scripted path.
+//
+// Usage: voxel_bench [line|circle|teleport] [seconds] [speed] [generator threads] [naive|greedy|binary|binary-greedy] [mesher threads]
+
+#define BENCH_TICK_RATE 60
+#define BENCH_DURATION_DEFAULT 30.0
+#define BENCH_SPEED_DEFAULT 120.0
+#define BENCH_CAMERA_HEIGHT 48.0f
+#define BENCH_CIRCLE_RADIUS 512.0
+#define BENCH_TELEPORT_INTERVAL 5.0
+#define BENCH_TELEPORT_RANGE 8192
+#define BENCH_SEED 19940126
+
+enum bench_path
+{
+	BENCH_PATH_LINE,
+	BENCH_PATH_CIRCLE,
+	BENCH_PATH_TELEPORT,
+};
+
+static const char* bench_path_names[] = { "line", "circle", "teleport" };
+
+static const char* bench_mesher_mode_names[MESHER_MODE_COUNT] = { "naive", "greedy", "binary", "binary-greedy" };
+
+static void thread_sleep(int nano_seconds)
+{
+	struct _ttherad_timespec time_sleep = { 0 };
+	timespec_get(&time_sleep, TIME_UTC);
+
+	time_sleep.tv_nsec += nano_seconds;
+	time_sleep.tv_sec += time_sleep.tv_nsec / 1000000000;
+	time_sleep.tv_nsec %= 1000000000;
+
+	thrd_sleep(&time_sleep, NULL);
+}
+
+static size_t peak_memory_bytes(void)
+{
+#if defined(_WIN32)
+	PROCESS_MEMORY_COUNTERS counters = { 0 };
+
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)) == false)
+	{
+		return 0;
+	}
+
+	return counters.PeakWorkingSetSize;
+#else
+	struct rusage usage = { 0 };
+
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+	{
+		return 0;
+	}
+
+	// ru_maxrss is reported in kilobytes.
+	return (size_t)usage.ru_maxrss * 1024;
+#endif
+}
+
+static void bench_path_update(enum bench_path path, double time, double speed)
+{
+	static double teleport_time = 0.0;
+
+	switch (path)
+	{
+	case BENCH_PATH_LINE:
+		Camera.position = GLKVector3Make((float)(time * speed), BENCH_CAMERA_HEIGHT, 0.0f);
+		break;
+
+	case BENCH_PATH_CIRCLE:
+	{
+		double angle = time * speed / BENCH_CIRCLE_RADIUS;
+
+		Camera.position.x = (float)(cos(angle) * BENCH_CIRCLE_RADIUS);
+		Camera.position.y = BENCH_CAMERA_HEIGHT;
+		Camera.position.z = (float)(sin(angle) * BENCH_CIRCLE_RADIUS);
+		break;
+	}
+
+	case BENCH_PATH_TELEPORT:
+		if (time - teleport_time >= BENCH_TELEPORT_INTERVAL)
+		{
+			teleport_time = time;
+
+			Camera.position.x = (float)(rand() % (BENCH_TELEPORT_RANGE * 2) - BENCH_TELEPORT_RANGE);
+			Camera.position.y = BENCH_CAMERA_HEIGHT;
+			Camera.position.z = (float)(rand() % (BENCH_TELEPORT_RANGE * 2) - BENCH_TELEPORT_RANGE);
+		}
+		break;
+	}
+
+	Camera.direction = GLKVector3Make(0.0f, 0.0f, -1.0f);
+	Camera.target = GLKVector3Add(Camera.position, Camera.direction);
+}
+
+static int bench_name_parse(const char* name, const char** names, int count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		if (strcmp(name, names[i]) == 0)
+		{
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+int main(int argc, char** argv)
+{
+	int path = BENCH_PATH_LINE;
+	double duration = BENCH_DURATION_DEFAULT;
+	double speed = BENCH_SPEED_DEFAULT;
+	int threads = 0;
+	int mesher_threads = 0;
+	int mode = MESHER_MODE_BINARY_GREEDY;
+
+	if (argc > 1)
+	{
+		path = bench_name_parse(argv[1], bench_path_names, 3);
+	}
+
+	if (argc > 5)
+	{
+		mode = bench_name_parse(argv[5], bench_mesher_mode_names, MESHER_MODE_COUNT);
+	}
+
+	if (path < 0 || mode < 0)
+	{
+		printf("Usage: %s [line|circle|teleport] [seconds] [speed] [generator threads] [naive|greedy|binary|binary-greedy] [mesher threads]\n", argv[0]);
+
+		return -1;
+	}
+
+	if (argc > 2)
+	{
+		duration = atof(argv[2]);
+	}
+
+	if (argc > 3)
+	{
+		speed = atof(argv[3]);
+	}
+
+	if (argc > 4)
+	{
+		threads = atoi(argv[4]);
+	}
+
+	if (argc > 6)
+	{
+		mesher_threads = atoi(argv[6]);
+	}
+
+	srand(BENCH_SEED);
+
+	Camera.up = GLKVector3Make(0.0f, 1.0f, 0.0f);
+	Camera.position = GLKVector3Make(0.0f, BENCH_CAMERA_HEIGHT, 0.0f);
+
+	mesher_setup_memory_buffer();
+
+	if (mesher_start_threads(mesher_threads) == false)
+	{
+		return -1;
+	}
+
+	mesher_mode_set(mode);
+
+	if (generator_start_threads(threads) == false)
+	{
+		return -1;
+	}
+
+	double time_start = timer_seconds();
+
+	world_init();
+
+	size_t ticks = 0;
+	double tick_time_total = 0.0;
+	double tick_time_max = 0.0;
+
+	while (true)
+	{
+		double time_tick = timer_seconds();
+		double elapsed = time_tick - time_start;
+
+		if (elapsed >= duration)
+		{
+			break;
+		}
+
+		bench_path_update(path, elapsed, speed);
+
+		world_tick();
+
+		double tick_time = timer_seconds() - time_tick;
+
+		ticks++;
+		tick_time_total += tick_time;
+		tick_time_max = max(tick_time_max, tick_time);
+
+		double remaining = 1.0 / BENCH_TICK_RATE - tick_time;
+
+		if (remaining > 0.0)
+		{
+			thread_sleep((int)(remaining * 1000000000.0));
+		}
+	}
+
+	double elapsed = timer_seconds() - time_start;
+
+	struct world_stats stats = { 0 };
+	world_stats_get(&stats);
+
+	size_t generated = generator_chunks_generated();
+	size_t uniform = generator_chunks_uniform();
+
+	size_t heightmap_hits = 0;
+	size_t heightmap_misses = 0;
+	generator_heightmap_stats(&heightmap_hits, &heightmap_misses);
+
+	struct mesher_stats mesher_stats = { 0 };
+	mesher_stats_get(&mesher_stats);
+
+	size_t meshed = mesher_stats.meshed;
+
+	printf("Path: %s, %.1f seconds, speed %.1f\n", bench_path_names[path], elapsed, speed);
+	printf("Ticks: %zu, avg %.3f ms, max %.3f ms\n", ticks, ticks ? tick_time_total / ticks * 1000.0 : 0.0, tick_time_max * 1000.0);
+	printf("Chunks generated: %zu (%.1f / s), heightmap cache %zu hits, %zu misses\n", generated, generated / elapsed, heightmap_hits, heightmap_misses);
+	printf("Chunks uniform: %zu (%.1f%%)\n", uniform, generated ? uniform * 100.0 / generated : 0.0);
+	printf("Chunks meshed: %zu (%.1f / s) %s, avg %.3f ms / chunk\n", meshed, meshed / elapsed, bench_mesher_mode_names[mode], meshed ? mesher_stats.mesh_seconds / meshed * 1000.0 : 0.0);
+	printf("Vertices: %zu (%.1f / chunk), %.1f MB\n",
+		mesher_stats.meshed_bytes / CHUNK_MESH_VERTEX_SIZE,
+		meshed ? (double)mesher_stats.meshed_bytes / CHUNK_MESH_VERTEX_SIZE / meshed : 0.0,
+		mesher_stats.meshed_bytes / (1024.0 * 1024.0));
+	printf("Mesh heap: %.1f MB used in %zu meshes, %.1f MB free in %zu blocks, largest %.1f MB\n",
+		mesher_stats.heap.used / (1024.0 * 1024.0),
+		mesher_stats.heap.allocations,
+		mesher_stats.heap.free / (1024.0 * 1024.0),
+		mesher_stats.heap.free_blocks,
+		mesher_stats.heap.free_largest / (1024.0 * 1024.0));
+	printf("Mesh cache: %zu hits, %zu misses (%.1f%% shared), %zu meshes cached\n",
+		mesher_stats.cache.hits,
+		mesher_stats.cache.misses,
+		mesher_stats.cache.hits + mesher_stats.cache.misses ? mesher_stats.cache.hits * 100.0 / (mesher_stats.cache.hits + mesher_stats.cache.misses) : 0.0,
+		mesher_stats.cache.meshes);
+	printf("Chunks activated: %zu, load latency avg %.3f ms, max %.3f ms\n",
+		stats.chunks_activated,
+		stats.chunks_activated ? stats.latency_total / stats.chunks_activated * 1000.0 : 0.0,
+		stats.latency_max * 1000.0);
+	printf("Chunks allocated: %zu, remeshed for level of detail: %zu\n", stats.chunks_allocated, stats.chunks_remeshed);
+	printf("Peak memory: %.1f MB\n", peak_memory_bytes() / (1024.0 * 1024.0));
+
+	generator_stop_threads();
+	mesher_stop_threads();
+
+	return 0;
+}
@@ -2,16 +2,195 @@
 
 #include "camera.h"
 #include "generator.h"
+#include "mesher.h"
 #include "renderer.h"
+#include "timer.h"
 #include "utility.h"
 
+#include <math.h>
+
 #define WORLD_CHUNK_RADIUS_DEFAULT 16
-#define WORLD_CHUNK_BUFFER_CAPACITY (32 * 32 * 8)
-#define WORLD_CHUNK_AVAILABLE_CAPACITY (32 * 32 * 8)
-#define WORLD_CHUNK_READY_CAPACITY 1024
+#define WORLD_CHUNK_POOL_CAPACITY (32 * 32 * 8)
+#define WORLD_CHUNK_POOL_SLACK CHUNK_POOL_SLAB_LENGTH
+#define WORLD_CHUNK_POOL_TRIM_INTERVAL 5.0
+// Every chunk handed back by the generator or mesher is a pool chunk, so the
+// ready queue can hold all of them at once and never overflows.
+#define WORLD_CHUNK_READY_CAPACITY WORLD_CHUNK_POOL_CAPACITY
+
+// Chunks this many chunks further from the player are meshed a level of
+// detail coarser.
+#define WORLD_LOD_BAND 6
+
+// Most active chunks handed back to the mesher per tick.
+#define WORLD_REMESH_PER_TICK 16
 
 static struct world world = { 0 };
 
+// Level of detail for a chunk at the given position.  Coarsening waits until
+// the chunk is a whole chunk past the band edge, so moving back and forth
+// across a chunk border does not remesh the chunks on the edge every time.
+static int world_chunk_lod(int x, int z, int lod_current)
+{
+	int distance = max(abs(world.player_chunk_x - x), abs(world.player_chunk_z - z));
+
+	int lod = min(distance / WORLD_LOD_BAND, CHUNK_LOD_MAX);
+
+	if (lod > lod_current)
+	{
+		int lod_inner = min(max(distance - 1, 0) / WORLD_LOD_BAND, CHUNK_LOD_MAX);
+
+		lod = max(lod_inner, lod_current);
+	}
+
+	return lod;
+}
+
+#ifndef VOXEL_HEADLESS
+// The step to the neighbour behind each face, in chunk_mesh normal order.
+static const int world_face_steps[6][3] =
+{
+	{ 0, -1, 0 },
+	{ 0, 1, 0 },
+	{ 0, 0, -1 },
+	{ 0, 0, 1 },
+	{ -1, 0, 0 },
+	{ 1, 0, 0 },
+};
+
+static struct chunk* world_chunk_get(int x, int y, int z)
+{
+	khint_t iter = kh_get(32, world.chunks_active, chunk_calculate_key(x, y, z));
+
+	if (iter == kh_end(world.chunks_active))
+	{
+		return NULL;
+	}
+
+	return kh_value(world.chunks_active, iter);
+}
+
+static bool world_chunk_in_range(int x, int z)
+{
+	return abs(world.player_chunk_x - x) <= world.chunk_radius && abs(world.player_chunk_z - z) <= world.chunk_radius;
+}
+
+// Pairs of faces connected through air inside the chunk.
+static int world_chunk_connectivity(const struct chunk* chunk)
+{
+	if (chunk->mesh != NULL)
+	{
+		return chunk->mesh->connectivity;
+	}
+
+	// Chunks without faces are either solid throughout or have no solid
+	// voxels inside.
+	return chunk->contents == CHUNK_CONTENTS_SOLID ? 0 : CHUNK_MESH_CONNECTIVITY_ALL;
+}
+
+// Whether any part of the chunk is in front of the camera.
+static bool world_chunk_ahead(const struct chunk* chunk)
+{
+	GLKVector3 center = GLKVector3AddScalar(chunk->aabb.min, CHUNK_LENGTH * 0.5f);
+	GLKVector3 direction = Camera.direction;
+
+	float distance = GLKVector3DotProduct(GLKVector3Subtract(center, Camera.position), direction);
+	float radius = (fabsf(direction.x) + fabsf(direction.y) + fabsf(direction.z)) * CHUNK_LENGTH * 0.5f;
+
+	return distance + radius >= 0.0f;
+}
+
+// Submits the chunks the camera can see through air.  A breadth first search
+// from the camera's chunk steps into a neighbour only through a face that
+// air connects to the face the search entered by, and never back towards
+// the camera, so caves and ground sealed off from the camera are never
+// reached.  Culling on the GPU tests every chunk itself, so the search is
+// skipped.
+static void world_render_visible(void)
+{
+	if (renderer_gpu_culling_get() == true)
+	{
+		return;
+	}
+
+	int camera_x = (int)floorf(Camera.position.x / CHUNK_LENGTH);
+	int camera_y = (int)floorf(Camera.position.y / CHUNK_LENGTH);
+	int camera_z = (int)floorf(Camera.position.z / CHUNK_LENGTH);
+
+	struct chunk* chunk = world_chunk_get(camera_x, camera_y, camera_z);
+
+	if (chunk == NULL)
+	{
+		// The camera is outside the loaded chunks, for example above them,
+		// so every chunk in range is submitted.
+		for (khint_t iter = kh_begin(world.chunks_active); iter != kh_end(world.chunks_active); ++iter)
+		{
+			if (kh_exist(world.chunks_active, iter))
+			{
+				chunk = kh_value(world.chunks_active, iter);
+
+				if (world_chunk_in_range(chunk->x, chunk->z) == true)
+				{
+					render_chunk(chunk);
+				}
+			}
+		}
+
+		return;
+	}
+
+	world.visit_search++;
+
+	chunk->visit_search = world.visit_search;
+	chunk->visit_face = -1;
+	chunk->visit_directions = 0;
+
+	queue_push(&world.chunks_visible, chunk);
+
+	while (chunk = queue_pop(&world.chunks_visible), chunk)
+	{
+		render_chunk(chunk);
+
+		int connectivity = world_chunk_connectivity(chunk);
+
+		for (int face = 0; face < 6; face++)
+		{
+			// Faces come in -axis, +axis pairs, so face ^ 1 is the opposite.
+			if (chunk->visit_directions & (1 << (face ^ 1)))
+			{
+				continue;
+			}
+
+			if (chunk->visit_face >= 0 && (connectivity & chunk_face_pair_bit(chunk->visit_face, face)) == 0)
+			{
+				continue;
+			}
+
+			int x = chunk->x + world_face_steps[face][0];
+			int y = chunk->y + world_face_steps[face][1];
+			int z = chunk->z + world_face_steps[face][2];
+
+			if (world_chunk_in_range(x, z) == false)
+			{
+				continue;
+			}
+
+			struct chunk* neighbour = world_chunk_get(x, y, z);
+
+			if (neighbour == NULL || neighbour->visit_search == world.visit_search || world_chunk_ahead(neighbour) == false)
+			{
+				continue;
+			}
+
+			neighbour->visit_search = world.visit_search;
+			neighbour->visit_face = face ^ 1;
+			neighbour->visit_directions = chunk->visit_directions | 1 << face;
+
+			queue_push(&world.chunks_visible, neighbour);
+		}
+	}
+}
+#endif
+
 static void load_chunk(int x, int y, int z)
 {
 	int key = chunk_calculate_key(x, y, z);
@@ -29,7 +208,7 @@ static void load_chunk(int x, int y, int z)
 	int result = 0;
 	khint_t index = kh_put(pending, world.chunks_pending, key, &result);
 
-	struct chunk* chunk = queue_pop(&world.chunks_available);
+	struct chunk* chunk = chunk_pool_acquire(&world.chunk_pool);
 
 	if (chunk == NULL)
 	{
@@ -38,9 +217,25 @@ static void load_chunk(int x, int y, int z)
 
 	chunk_init(chunk, x, y, z);
 
+	chunk->lod_requested = world_chunk_lod(x, z, CHUNK_LOD_MAX);
+
+	chunk->time_queued = timer_seconds();
+
 	generator_queue_work(chunk);
 }
 
+static void load_area(int center_x, int center_z)
+{
+	for (int z = center_z - world.chunk_radius; z < center_z + world.chunk_radius; z++)
+	{
+		for (int x = center_x - world.chunk_radius; x < center_x + world.chunk_radius; x++)
+		{
+			load_chunk(x, 0, z);
+			load_chunk(x, 1, z);
+		}
+	}
+}
+
 void world_init(void)
 {
 	world.player_chunk_x = 0;
@@ -49,39 +244,27 @@ void world_init(void)
 	world.chunk_radius = 20;
 	world.chunk_radius_unload = world.chunk_radius + 8;
 
-	queue_init(&world.chunks_available, WORLD_CHUNK_AVAILABLE_CAPACITY);
+	chunk_pool_init(&world.chunk_pool, WORLD_CHUNK_POOL_CAPACITY);
 
-	world.chunk_buffer = malloc(WORLD_CHUNK_BUFFER_CAPACITY * sizeof(struct chunk));
-	check_allocation(world.chunk_buffer);
-
-	for (int i = 0; i < WORLD_CHUNK_BUFFER_CAPACITY; i++)
-	{
-		queue_push(&world.chunks_available, &world.chunk_buffer[i]);
-	}
+	world.time_pool_trimmed = timer_seconds();
 
 	queue_safe_init(&world.chunks_ready, WORLD_CHUNK_READY_CAPACITY);
 
 	world.chunks_active = kh_init(32);
 
+	queue_init(&world.chunks_visible, WORLD_CHUNK_POOL_CAPACITY);
+
 	world.chunks_pending = kh_init(pending);
 
 	// Generate the chunks around the origin.
-
-	for (int z = -world.chunk_radius; z < world.chunk_radius; z++)
-	{
-		for (int x = -world.chunk_radius; x < world.chunk_radius; x++)
-		{
-			load_chunk(x, 0, z);
-			load_chunk(x, 1, z);
-		}
-	}
+	load_area(0, 0);
 }
 
 void world_free(void)
 {
-	free(world.chunk_buffer);
-	queue_free(&world.chunks_available);
+	chunk_pool_free(&world.chunk_pool);
 	queue_safe_free(&world.chunks_ready);
+	queue_free(&world.chunks_visible);
 }
 
 void world_tick(void)
@@ -89,50 +272,99 @@ void world_tick(void)
 	// Insert processed chunks into the world.
 	struct chunk* chunk = NULL;
 
+	double time_now = timer_seconds();
+
 	while (chunk = queue_safe_pop(&world.chunks_ready), chunk)
 	{
+		if (chunk->remeshing == true)
+		{
+			// An active chunk came back with a new level of detail.  Its old
+			// mesh is released and kept until the GPU is done with it.
+			if (chunk->mesh != NULL)
+			{
+				chunk->mesh->release(chunk);
+			}
+
+			chunk->mesh = chunk->remesh;
+			chunk->remesh = NULL;
+			chunk->lod = chunk->lod_requested;
+			chunk->remeshing = false;
+
+#ifndef VOXEL_HEADLESS
+			renderer_chunk_update(chunk);
+#endif
+
+			world.stats.chunks_remeshed++;
+
+			continue;
+		}
+
+		chunk->lod = chunk->lod_requested;
+
+#ifndef VOXEL_HEADLESS
+		renderer_chunk_update(chunk);
+#endif
+
 		int hashmap_result = 0;
 		khint_t k = kh_put(32, world.chunks_active, chunk->key, &hashmap_result);
 		kh_value(world.chunks_active, k) = chunk;
 
 		khint_t iter = kh_get(pending, world.chunks_pending, chunk->key);
 		kh_del(pending, world.chunks_pending, iter);
+
+		double latency = time_now - chunk->time_queued;
+
+		world.stats.chunks_activated++;
+		world.stats.latency_total += latency;
+		world.stats.latency_max = max(world.stats.latency_max, latency);
 	}
 
 	// Check if we need to generate some chunks.
 	int player_chunk_x_new = Camera.position.x / CHUNK_LENGTH;
 	int player_chunk_z_new = Camera.position.z / CHUNK_LENGTH;
 
-	if (player_chunk_x_new != world.player_chunk_x)
+	int delta_x = player_chunk_x_new - world.player_chunk_x;
+	int delta_z = player_chunk_z_new - world.player_chunk_z;
+
+	if (abs(delta_x) > 1 || abs(delta_z) > 1)
+	{
+		// The player moved further than the strip logic below handles, for
+		// example a teleport.  Fill in the whole area around the new position.
+		load_area(player_chunk_x_new, player_chunk_z_new);
+	}
+	else
 	{
-		int radius = world.chunk_radius * (player_chunk_x_new - world.player_chunk_x);
+		if (delta_x != 0)
+		{
+			int radius = world.chunk_radius * delta_x;
 
-		int small_x = min(world.player_chunk_x + radius, player_chunk_x_new + radius);
-		int large_x = max(world.player_chunk_x + radius, player_chunk_x_new + radius);
+			int small_x = min(world.player_chunk_x + radius, player_chunk_x_new + radius);
+			int large_x = max(world.player_chunk_x + radius, player_chunk_x_new + radius);
 
-		for (int x = small_x; x < large_x; x++)
-		{
-			for (int z = player_chunk_z_new - world.chunk_radius; z < player_chunk_z_new + world.chunk_radius; z++)
+			for (int x = small_x; x < large_x; x++)
 			{
-				load_chunk(x, 0, z);
-				load_chunk(x, 1, z);
+				for (int z = player_chunk_z_new - world.chunk_radius; z < player_chunk_z_new + world.chunk_radius; z++)
+				{
+					load_chunk(x, 0, z);
+					load_chunk(x, 1, z);
+				}
 			}
 		}
-	}
 
-	if (player_chunk_z_new != world.player_chunk_z)
-	{
-		int radius = world.chunk_radius * (player_chunk_z_new - world.player_chunk_z);
+		if (delta_z != 0)
+		{
+			int radius = world.chunk_radius * delta_z;
 
-		int small_z = min(world.player_chunk_z + radius, player_chunk_z_new + radius);
-		int large_z = max(world.player_chunk_z + radius, player_chunk_z_new + radius);
+			int small_z = min(world.player_chunk_z + radius, player_chunk_z_new + radius);
+			int large_z = max(world.player_chunk_z + radius, player_chunk_z_new + radius);
 
-		for (int z = small_z; z < large_z; z++)
-		{
-			for (int x = player_chunk_x_new - world.chunk_radius; x < player_chunk_x_new + world.chunk_radius; x++)
+			for (int z = small_z; z < large_z; z++)
 			{
-				load_chunk(x, 0, z);
-				load_chunk(x, 1, z);
+				for (int x = player_chunk_x_new - world.chunk_radius; x < player_chunk_x_new + world.chunk_radius; x++)
+				{
+					load_chunk(x, 0, z);
+					load_chunk(x, 1, z);
+				}
 			}
 		}
 	}
@@ -140,7 +372,10 @@ void world_tick(void)
 	world.player_chunk_x = player_chunk_x_new;
 	world.player_chunk_z = player_chunk_z_new;
 
-	// Submit chunks around the camera for rendering.
+	// Unload chunks out of range and remesh those whose level of detail
+	// changed.
+	int remesh_budget = WORLD_REMESH_PER_TICK;
+
 	for (khint_t iter = kh_begin(world.chunks_active); iter != kh_end(world.chunks_active); ++iter)
 	{
 		if (kh_exist(world.chunks_active, iter))
@@ -152,27 +387,81 @@ void world_tick(void)
 
 			if (dist_x > world.chunk_radius || dist_z > world.chunk_radius)
 			{
-				if (dist_x > world.chunk_radius_unload || dist_z > world.chunk_radius_unload)
+				// Chunks being remeshed are still owned by the mesher and are
+				// unloaded once they come back.
+				if ((dist_x > world.chunk_radius_unload || dist_z > world.chunk_radius_unload) && chunk->remeshing == false)
 				{
 					kh_del(32, world.chunks_active, iter);
 
+#ifndef VOXEL_HEADLESS
+					renderer_chunk_remove(chunk);
+#endif
+
 					if (chunk->mesh != NULL)
 					{
 						chunk->mesh->release(chunk);
 					}
 					
-					queue_push(&world.chunks_available, chunk);
+					chunk_pool_release(&world.chunk_pool, chunk);
 				}
 
 				continue;
 			}
 
-			render_chunk(chunk);
+			// Uniform chunks have no faces at any level of detail.
+			bool meshable = chunk->contents == CHUNK_CONTENTS_MIXED || chunk->contents == CHUNK_CONTENTS_SOLID_EXPOSED;
+
+			if (meshable == true && chunk->remeshing == false && remesh_budget > 0)
+			{
+				int lod = world_chunk_lod(chunk->x, chunk->z, chunk->lod);
+
+				if (lod != chunk->lod)
+				{
+					chunk->lod_requested = lod;
+					chunk->remeshing = true;
+
+					mesher_queue_work(chunk);
+
+					remesh_budget--;
+				}
+			}
 		}
 	}
+
+#ifndef VOXEL_HEADLESS
+	// Submit the chunks the camera can see for rendering.
+	world_render_visible();
+#endif
+
+	// Give memory held by unused chunks back, for example after the view
+	// radius shrinks or a teleport.  Rate limited since chunks released while
+	// moving are usually reused within a few ticks.
+	if (time_now - world.time_pool_trimmed > WORLD_CHUNK_POOL_TRIM_INTERVAL)
+	{
+		chunk_pool_trim(&world.chunk_pool, WORLD_CHUNK_POOL_SLACK);
+
+		world.time_pool_trimmed = time_now;
+	}
+}
+
+void world_stats_get(struct world_stats* stats)
+{
+	*stats = world.stats;
+
+	stats->chunks_allocated = chunk_pool_allocated(&world.chunk_pool);
+}
+
+int world_chunk_radius_get(void)
+{
+	return world.chunk_radius;
 }
 
 void world_add_chunk(struct chunk* chunk)
 {
-	queue_safe_push(&world.chunks_ready, chunk);
+	// Cannot fail while the queue holds every pool chunk.  A dropped chunk
+	// would stay pending and its coordinate would never load.
+	if (queue_safe_push(&world.chunks_ready, chunk) == false)
+	{
+		log_error("Chunk ready queue is full, dropped chunk %d %d %d.", chunk->x, chunk->y, chunk->z);
+	}
 }